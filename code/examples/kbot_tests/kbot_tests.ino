@@ -19,12 +19,21 @@
 
 Blinker blinker(LED_IND, 1000*Scheduler::millisecond);
 
-BatteryMonitor batt_mon(3.0, BATT_1, BATT_2, BATT_3, BUZZER, 1000*Scheduler::millisecond);
+Buzzer buzzer(10*Scheduler::millisecond);
+BatteryMonitor batt_mon(3.0, BATT_1, BATT_2, BATT_3, &buzzer,
+                        20*Scheduler::millisecond);
 
 Odometry odometer(10*Scheduler::millisecond);
-DifferentialDrive dd_drive(10*Scheduler::millisecond);
+Propulsion dd_drive(10*Scheduler::millisecond);
 SpeedProfiler speed_profiler(10*Scheduler::millisecond);
-UserControl user_control(100*Scheduler::microsecond);
+ButtonPad buttons(5*Scheduler::millisecond);
+UserControl user_control(20*Scheduler::millisecond);
+MatchTimer match_timer(2*Scheduler::millisecond);
+ExtensionBoard extension;
+
+// Order of the buttons must match the BTN_* indexes of user_control.h
+const uint8_t ui_buttons[] = {UI_BTN_UP, UI_BTN_DOWN, UI_BTN_CENTER,
+                              UI_BTN_LEFT, UI_BTN_RIGHT};
 
 void setup() {
   //Serial.begin(115200);
@@ -44,29 +53,47 @@ void setup() {
                  &odometer,
                  SHAFT_WIDTH, LEFT_RADIUS, RIGHT_RADIUS);
   dd_drive.invert_motor_commands(false, true);
-  dd_drive.set_motor_mode(DifferentialDrive::enable);
+  dd_drive.set_motor_mode(Propulsion::enable);
   dd_drive.set_dead_zones(40, 40);
+  // Use autotuned gains if available instead of KP/KI
+  dd_drive.load_gains(GAINS_EEPROM_ADDR);
+
+  buttons.begin(ui_buttons, 5);
+
+  // The robot stops by itself at the end of the match once the start cord
+  // has been inserted then pulled
+  match_timer.begin(START_BTN, &speed_profiler, &dd_drive);
 
   // USB
   /*user_control.begin(&Serial, 115200,
                      &batt_mon, &speed_profiler, &dd_drive, &odometer,
-                     UI_BTN_UP, UI_BTN_DOWN, UI_BTN_CENTER, UI_BTN_LEFT, UI_BTN_RIGHT,
+                     &buttons,
                      UI_LED0,
                      N_POSSIBLE_DIRECTIONS);*/
   // Bluetooth
   user_control.begin(&Serial2, 9600,
                      &batt_mon, &speed_profiler, &dd_drive, &odometer,
-                     UI_BTN_UP, UI_BTN_DOWN, UI_BTN_CENTER, UI_BTN_LEFT, UI_BTN_RIGHT,
+                     &buttons,
                      UI_LED0,
                      N_POSSIBLE_DIRECTIONS);
+
+  // Extension board channels have to be registered before the scan starts
+  extension.begin(EXT_DET, EXT_S1, EXT_S2);
+
+  // Battery cells are sampled in the background from now on
+  AdcScanner::begin();
+  buzzer.begin(BUZZER);
                  
   Scheduler::begin();
   Scheduler::add_task(&blinker);
   Scheduler::add_task(&batt_mon);
+  Scheduler::add_task(&buzzer);
   Scheduler::add_task(&odometer);
   Scheduler::add_task(&speed_profiler);
   Scheduler::add_task(&dd_drive);
+  Scheduler::add_task(&buttons);
   Scheduler::add_task(&user_control);
+  Scheduler::add_task(&match_timer);
 }
 
 void loop() {
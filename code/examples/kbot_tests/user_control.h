@@ -9,6 +9,21 @@
 #define ROT_SPEED M_PI/4.
 #define ROT_ACC (ROT_SPEED)
 
+#define AUTOTUNE_RELAY_CMD 60
+#define AUTOTUNE_HYSTERESIS 0.05
+#define AUTOTUNE_CYCLES 4
+
+// Location of the autotuned controller gains in EEPROM, saved by the
+// autotune command and loaded in setup()
+#define GAINS_EEPROM_ADDR 0
+
+// Indexes of the buttons in the ButtonPad
+#define BTN_UP 0
+#define BTN_DOWN 1
+#define BTN_CENTER 2
+#define BTN_LEFT 3
+#define BTN_RIGHT 4
+
 class UserControl : public ScheduledTask {
  public:
   UserControl(unsigned long period) : ScheduledTask(period) { }
@@ -16,11 +31,9 @@ class UserControl : public ScheduledTask {
   void begin(HardwareSerial *ui_serial, long baudrate,
              BatteryMonitor *batt,
              SpeedProfiler *speed_profiler,
-             DifferentialDrive *ddrive,
+             Propulsion *ddrive,
              Odometry *odometer,
-             uint8_t up, uint8_t down,
-             uint8_t center,
-             uint8_t left, uint8_t right,
+             ButtonPad *buttons,
              uint8_t following_led,
              unsigned int n_directions) {
                
@@ -29,20 +42,11 @@ class UserControl : public ScheduledTask {
     speed_profiler_ = speed_profiler;
     ddrive_ = ddrive;
     odometer_ = odometer;
-    up_ = up;
-    down_ = down;
-    center_ = center;
-    left_ = left;
-    right_ = right;
+    buttons_ = buttons;
     follow_led_ = following_led;
     n_dir_ = n_directions;
     
     ui_serial_->begin(baudrate);
-    pinMode(up, INPUT_PULLUP);
-    pinMode(down, INPUT_PULLUP);
-    pinMode(center, INPUT_PULLUP);
-    pinMode(left, INPUT_PULLUP);
-    pinMode(right, INPUT_PULLUP);
     pinMode(following_led, OUTPUT);
     
     ui_serial_->println("Kbot ready for orders !");
@@ -54,22 +58,28 @@ class UserControl : public ScheduledTask {
     // Display SpeedProfiler state on one LED
     digitalWrite(follow_led_, speed_profiler_->is_following_profile() != SpeedProfiler::none ? HIGH : LOW);
 
-    // Manage the inputs from the "keyboard":
-    if (speed_profiler_->is_following_profile() == SpeedProfiler::none) {
-      if (digitalRead(up_) == LOW) {
-        speed_profiler_->start_linear_profile_theta(DISTANCE, LIN_SPEED, LIN_ACC, speed_profiler_->automatic_heading(n_dir_));
-      }
-      if (digitalRead(down_) == LOW) {
-        speed_profiler_->start_linear_profile_theta(-DISTANCE, LIN_SPEED, LIN_ACC, speed_profiler_->automatic_heading(n_dir_));
+    // Manage the inputs from the "keyboard": one move per press
+    ButtonEvent event;
+    while (buttons_->read_event(&event) == 0) {
+      if (event.type != ButtonEvent::press) {
+        continue;
       }
-      if (digitalRead(left_) == LOW) {
-        speed_profiler_->start_rotation_profile(2.*M_PI/n_dir_, ROT_SPEED, ROT_ACC);
-      }
-      if (digitalRead(right_) == LOW) {
-        speed_profiler_->start_rotation_profile(-2.*M_PI/n_dir_, ROT_SPEED, ROT_ACC);
-      }
-    } else {
-      if (digitalRead(center_) == LOW) {
+      if (speed_profiler_->is_following_profile() == SpeedProfiler::none) {
+        switch (event.button) {
+          case BTN_UP:
+            speed_profiler_->start_linear_profile_theta(DISTANCE, LIN_SPEED, LIN_ACC, speed_profiler_->automatic_heading(n_dir_));
+            break;
+          case BTN_DOWN:
+            speed_profiler_->start_linear_profile_theta(-DISTANCE, LIN_SPEED, LIN_ACC, speed_profiler_->automatic_heading(n_dir_));
+            break;
+          case BTN_LEFT:
+            speed_profiler_->start_rotation_profile(2.*M_PI/n_dir_, ROT_SPEED, ROT_ACC);
+            break;
+          case BTN_RIGHT:
+            speed_profiler_->start_rotation_profile(-2.*M_PI/n_dir_, ROT_SPEED, ROT_ACC);
+            break;
+        }
+      } else if (event.button == BTN_CENTER) {
         speed_profiler_->stop_motion();
       }
     }
@@ -141,6 +151,14 @@ class UserControl : public ScheduledTask {
           ui_serial_->print(batt_->get_total_voltage());
           ui_serial_->println(" V.");
           break;
+        case 't':
+          // Autotune the wheels' controllers
+          if (speed_profiler_->is_following_profile() == SpeedProfiler::none) {
+            ui_serial_->println("Tuning my wheels, please lift me up.");
+            ddrive_->start_autotune(AUTOTUNE_RELAY_CMD, AUTOTUNE_HYSTERESIS,
+                                    AUTOTUNE_CYCLES, GAINS_EEPROM_ADDR);
+          }
+          break;
         case 'h':
           // Printing help
           ui_serial_->println("Here is what I can do:");
@@ -152,6 +170,7 @@ class UserControl : public ScheduledTask {
           ui_serial_->println("r: turning right");
           ui_serial_->println("o: displaying odometry values");
           ui_serial_->println("p: display battery infos");
+          ui_serial_->println("t: autotune wheels controllers");
           break;
         default:
           ui_serial_->println("I'm sorry but I don't understand what you mean there...");
@@ -162,9 +181,10 @@ class UserControl : public ScheduledTask {
  protected:
   HardwareSerial *ui_serial_;
   SpeedProfiler *speed_profiler_;
-  DifferentialDrive *ddrive_;
+  Propulsion *ddrive_;
   Odometry *odometer_;
   BatteryMonitor *batt_;
-  uint8_t up_, down_, center_, left_, right_, follow_led_;
+  ButtonPad *buttons_;
+  uint8_t follow_led_;
   unsigned int n_dir_;
 };
@@ -29,6 +29,8 @@
 #define COD2_B_INTERRUPT 5
 #define MOT2_EN 9
 
+// MOT3_1 is on TIMER2, used by the buzzer: HBridge never puts PWM on it and
+// drives motor 3 forward with MOT3_1 high and an inverted PWM on MOT3_2
 #define MOT3_1 10
 #define MOT3_2 11
 #define COD3_A 21
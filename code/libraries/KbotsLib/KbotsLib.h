@@ -9,9 +9,23 @@
 #define __KBOTSLIB_H
 
 #include <scheduler.h>
+#include "adc_scanner.h"
+#include "extension_board.h"
+#include "buzzer.h"
 #include "battery_monitor.h"
 #include "odometry.h"
+#include "pin_change.h"
 #include "propulsion.h"
+#include "hbridge.h"
+#include "relay_autotuner.h"
+#include "motion_profile.h"
 #include "speed_profiler.h"
+#include "speed_governor.h"
+#include "ir_range_array.h"
+#include "ils_capture.h"
+#include "spi_bus.h"
+#include "ui_leds.h"
+#include "button_pad.h"
+#include "match_timer.h"
 
 #endif /* __KBOTSLIB_H */
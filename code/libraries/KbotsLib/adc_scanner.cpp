@@ -0,0 +1,183 @@
+/************************************************************************
+ * File : adc_scanner.cpp                                               *
+ *  Interrupt driven scan of the analog inputs.                         *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It owns the ADC interrupt vector, so analogRead() must not be used   *
+ * once the scan is started.                                            *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "adc_scanner.h"
+
+uint8_t AdcScanner::channels_[ADC_SCANNER_MAX_CHANNELS];
+uint8_t AdcScanner::n_channels_ = 0;
+unsigned int AdcScanner::results_[2][ADC_SCANNER_MAX_CHANNELS];
+unsigned long AdcScanner::stamps_[2][ADC_SCANNER_MAX_CHANNELS];
+volatile uint8_t AdcScanner::front_ = 0;
+volatile unsigned int AdcScanner::scan_count_ = 0;
+uint8_t AdcScanner::extra_bits_ = 0;
+uint8_t AdcScanner::running_ = 0;
+uint8_t AdcScanner::cur_ = 0;
+uint8_t AdcScanner::discard_ = 0;
+unsigned int AdcScanner::n_samples_ = 1;
+unsigned int AdcScanner::count_ = 0;
+unsigned int AdcScanner::sum_ = 0;
+
+char AdcScanner::add_channel(uint8_t pin) {
+  if (pin >= A0) {
+    pin -= A0;
+  }
+  if (pin >= ADC_SCANNER_MAX_CHANNELS) {
+    return -1;
+  }
+
+  for (uint8_t i=0; i < n_channels_; i++) {
+    if (channels_[i] == pin) {
+      return i;
+    }
+  }
+  if (n_channels_ >= ADC_SCANNER_MAX_CHANNELS) {
+    return -1;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  channels_[n_channels_] = pin;
+  results_[0][n_channels_] = 0;
+  results_[1][n_channels_] = 0;
+  stamps_[0][n_channels_] = 0;
+  stamps_[1][n_channels_] = 0;
+  n_channels_++;
+  if (running_) {
+    // Disable the digital input buffer of the pin
+    if (pin < 8) {
+      DIDR0 |= _BV(pin);
+    } else {
+      DIDR2 |= _BV(pin - 8);
+    }
+  }
+  SREG = oldSREG;
+
+  return n_channels_ - 1;
+}
+
+char AdcScanner::begin(uint8_t extra_bits) {
+  if (n_channels_ == 0) {
+    return -1;
+  }
+  if (running_) {
+    return 0;
+  }
+
+  if (extra_bits > ADC_SCANNER_MAX_EXTRA_BITS) {
+    extra_bits = ADC_SCANNER_MAX_EXTRA_BITS;
+  }
+  extra_bits_ = extra_bits;
+  n_samples_ = 1 << (2 * extra_bits);
+
+  // Disable the digital input buffers of the scanned pins
+  for (uint8_t i=0; i < n_channels_; i++) {
+    if (channels_[i] < 8) {
+      DIDR0 |= _BV(channels_[i]);
+    } else {
+      DIDR2 |= _BV(channels_[i] - 8);
+    }
+  }
+
+  // Single conversions restarted from the interrupt, 125kHz ADC clock
+  // (104us per conversion)
+  cur_ = 0;
+  count_ = 0;
+  sum_ = 0;
+  discard_ = 0;
+  running_ = 1;
+  select(0);
+  ADCSRA = _BV(ADEN) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
+  ADCSRA |= _BV(ADSC);
+
+  // Wait for the first scan to be complete
+  while (scan_count_ == 0) ;
+
+  return 0;
+}
+
+uint8_t AdcScanner::is_running() {
+  return running_;
+}
+
+int AdcScanner::read(char channel) {
+  return read_raw(channel) >> extra_bits_;
+}
+
+unsigned int AdcScanner::read_raw(char channel) {
+  if (channel < 0 || channel >= n_channels_) {
+    return 0;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int value = results_[front_][(uint8_t)channel];
+  SREG = oldSREG;
+  return value;
+}
+
+unsigned long AdcScanner::get_timestamp(char channel) {
+  if (channel < 0 || channel >= n_channels_) {
+    return 0;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long stamp = stamps_[front_][(uint8_t)channel];
+  SREG = oldSREG;
+  return stamp;
+}
+
+unsigned int AdcScanner::get_scan_count() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int count = scan_count_;
+  SREG = oldSREG;
+  return count;
+}
+
+void AdcScanner::select(uint8_t channel) {
+  uint8_t mux = channels_[channel];
+  ADCSRB = (ADCSRB & ~_BV(MUX5)) | (((mux >> 3) & 0x01) << MUX5);
+  ADMUX = _BV(REFS0) | (mux & 0x07);
+}
+
+void AdcScanner::conversion_complete() {
+  unsigned int value = ADC;
+
+  // The first conversion after switching the multiplexer is not reliable
+  // with high impedance sources: drop it
+  if (discard_) {
+    discard_ = 0;
+  } else {
+    sum_ += value;
+    count_++;
+    if (count_ >= n_samples_) {
+      uint8_t back = front_ ^ 1;
+      results_[back][cur_] = sum_ >> extra_bits_;
+      stamps_[back][cur_] = micros();
+      sum_ = 0;
+      count_ = 0;
+      cur_++;
+      if (cur_ >= n_channels_) {
+        cur_ = 0;
+        front_ = back;
+        scan_count_++;
+      }
+      if (n_channels_ > 1) {
+        select(cur_);
+        discard_ = 1;
+      }
+    }
+  }
+
+  ADCSRA |= _BV(ADSC);
+}
+
+ISR(ADC_vect) {
+  AdcScanner::conversion_complete();
+}
@@ -0,0 +1,102 @@
+/************************************************************************
+ * File : adc_scanner.h                                                 *
+ *  Interrupt driven scan of the analog inputs.                         *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It owns the ADC interrupt vector, so analogRead() must not be used   *
+ * once the scan is started.                                            *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __ADC_SCANNER_H
+#define __ADC_SCANNER_H
+
+#include <Arduino.h>
+
+// Maximum number of channels in the scan list (all the analog inputs of the
+// Mega)
+#define ADC_SCANNER_MAX_CHANNELS 16
+
+// Maximum number of extra bits of resolution: 4^3 samples of 10 bits still
+// fit in 16 bits
+#define ADC_SCANNER_MAX_EXTRA_BITS 3
+
+class AdcScanner {
+ public:
+  // static char add_channel(uint8_t pin):
+  //  Add an analog input to the scan list. This can be done before begin()
+  //  (from constructors for instance), the value of a channel added while
+  //  the scan is running is available after the next complete scan.
+  // Parameters:
+  //  - pin: analog pin (A0..A15, or the channel number 0..15)
+  // Return value:
+  //  -1 if the pin is not an analog input or if the list is full.
+  //  Index of the channel otherwise. Adding a pin twice returns the same
+  //  index.
+  static char add_channel(uint8_t pin);
+
+  // static char begin(uint8_t extra_bits):
+  //  Start scanning the channel list continuously from the ADC interrupt.
+  //  This function waits for the first scan to complete so that values are
+  //  valid as soon as it returns, it has to be called with interrupts
+  //  enabled (from setup() for instance).
+  // Parameters:
+  //  - extra_bits: number of bits of resolution gained by oversampling and
+  //                decimation. Each value is computed from 4^extra_bits
+  //                conversions (at most ADC_SCANNER_MAX_EXTRA_BITS).
+  // Return value:
+  //  -1 if the channel list is empty.
+  //  Zero if no error is encountered.
+  static char begin(uint8_t extra_bits = 0);
+
+  // static uint8_t is_running():
+  //  Return 1 if the scan has been started, 0 otherwise.
+  static uint8_t is_running();
+
+  // static int read(char channel):
+  //  Return the last value of a channel with the 10 bits scale of
+  //  analogRead().
+  static int read(char channel);
+
+  // static unsigned int read_raw(char channel):
+  //  Return the last value of a channel with its full resolution
+  //  (10 + extra_bits bits).
+  static unsigned int read_raw(char channel);
+
+  // static unsigned long get_timestamp(char channel):
+  //  Return the time (micros()) at which the last value of a channel was
+  //  completed.
+  static unsigned long get_timestamp(char channel);
+
+  // static unsigned int get_scan_count():
+  //  Return the number of complete scans since begin(). It can be used to
+  //  detect new values.
+  static unsigned int get_scan_count();
+
+  // static void conversion_complete():
+  //  For internal use by the interrupt vector: accumulates the result and
+  //  starts the next conversion.
+  static void conversion_complete();
+
+ protected:
+  // static void select(uint8_t channel):
+  //  Route an input to the ADC.
+  static void select(uint8_t channel);
+
+  // Channel list
+  static uint8_t channels_[ADC_SCANNER_MAX_CHANNELS];
+  static uint8_t n_channels_;
+
+  // Results are written in the back buffer during a scan, the buffers are
+  // swapped when it is complete so that readers always get a whole scan.
+  static unsigned int results_[2][ADC_SCANNER_MAX_CHANNELS];
+  static unsigned long stamps_[2][ADC_SCANNER_MAX_CHANNELS];
+  static volatile uint8_t front_;
+  static volatile unsigned int scan_count_;
+
+  // State of the scan
+  static uint8_t extra_bits_, running_, cur_, discard_;
+  static unsigned int n_samples_, count_, sum_;
+};
+
+#endif // __ADC_SCANNER_H
@@ -7,69 +7,194 @@
  * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
  ************************************************************************/
 #include "battery_monitor.h"
+#include "propulsion.h"
+
+// Conversion from filtered ADC values (ADC * 64) to millivolts, in 1/65536
+// of millivolts: 1000 * 1024 * volts per ADC unit
+#define CELL12_GAIN 14792UL // 0.014445 V
+#define CELL3_GAIN 5000UL   // 0.0048828 V
+
+// Cells below this voltage are considered as not connected (millivolts)
+#define CELL_NOT_CONNECTED 2000
+
+// Open circuit voltage of a LiPo cell in millivolts, from 0% to 100% of
+// charge by steps of 10%
+#define CHARGE_TABLE_LENGTH 11
+static const uint16_t charge_table[CHARGE_TABLE_LENGTH] PROGMEM = {
+  3270, 3690, 3730, 3770, 3800, 3840, 3870, 3950, 4020, 4110, 4200
+};
 
 BatteryMonitor::BatteryMonitor(float minimum_voltage,
                                uint8_t cell1_pin,
                                uint8_t cell2_pin,
                                uint8_t cell3_pin,
-                               uint8_t buzzer_pin,
+                               Buzzer *buzzer,
                                unsigned long period) :
                       ScheduledTask(period) {
   cell_pins_[0] = cell1_pin;
   cell_pins_[1] = cell2_pin;
   cell_pins_[2] = cell3_pin;
-  buzz_ = buzzer_pin;
+  for (uint8_t i=0; i < 3; i++) {
+    cell_channels_[i] = AdcScanner::add_channel(cell_pins_[i]);
+  }
+
+  started_ = false;
+  min_mv_ = minimum_voltage * 1000.;
+  propulsion_ = NULL;
+  sag_ = 0;
+  buzzer_ = buzzer;
+  alarm_ = 0;
+  log_head_ = 0;
+  log_length_ = 0;
+}
 
-  pinMode(buzz_, OUTPUT);
+void BatteryMonitor::set_load_compensation(Propulsion *propulsion, float sag) {
+  propulsion_ = propulsion;
+  sag_ = sag > 0. ? sag * 1000. * 256. / 255. : 0;
+}
 
-  for (char i=0; i < 3; i++) {
-    cell_v_[i] = NAN;
+int BatteryMonitor::read_cell(uint8_t cell) {
+  if (AdcScanner::is_running() && cell_channels_[cell] >= 0) {
+    return AdcScanner::read(cell_channels_[cell]);
   }
+  return analogRead(cell_pins_[cell]);
+}
 
-  min_voltage_ = minimum_voltage;
+int BatteryMonitor::charge_from_voltage(int mv) {
+  if (mv <= (int)pgm_read_word(&charge_table[0])) {
+    return 0;
+  }
+  for (uint8_t i=1; i < CHARGE_TABLE_LENGTH; i++) {
+    int v1 = pgm_read_word(&charge_table[i]);
+    if (mv < v1) {
+      int v0 = pgm_read_word(&charge_table[i-1]);
+      return (i-1) * 100 + (long)(mv - v0) * 100 / (v1 - v0);
+    }
+  }
+  return 1000;
 }
 
 void BatteryMonitor::run() {
-  // Get values
-  cell_v_[0] = analogRead(cell_pins_[0]) * 0.014445;
-  cell_v_[1] = analogRead(cell_pins_[1]) * 0.014445;
-  cell_v_[2] = analogRead(cell_pins_[2]) * 0.0048828;
+  // Filter the values (first order low pass filter)
+  for (uint8_t i=0; i < 3; i++) {
+    uint16_t value = (uint16_t)read_cell(i) << 6;
+    if (started_) {
+      filtered_[i] += ((long)value - filtered_[i]) >> BATTERY_FILTER_SHIFT;
+    } else {
+      filtered_[i] = value;
+    }
+  }
+  started_ = true;
 
   // Deduce voltage of each element
-  cell_v_[0] -= cell_v_[1];
-  cell_v_[1] -= cell_v_[2];
+  int v[3];
+  v[0] = ((uint32_t)filtered_[0] * CELL12_GAIN) >> 16;
+  v[1] = ((uint32_t)filtered_[1] * CELL12_GAIN) >> 16;
+  v[2] = ((uint32_t)filtered_[2] * CELL3_GAIN) >> 16;
+
+  // Voltage drop caused by the motors
+  int comp = 0;
+  if (propulsion_ != NULL) {
+    comp = ((uint32_t)propulsion_->get_total_duty() * sag_) >> 8;
+  }
+  cell_mv_[0] = v[0] - v[1] + comp;
+  cell_mv_[1] = v[1] - v[2] + comp;
+  cell_mv_[2] = v[2] + comp;
 
   // Alarm if one cell is too low
-  char alarm = 0, not_connected = 0;
-  for (char i=0; i < 3; i++) {
-    if (cell_v_[i] <= min_voltage_) {
-      alarm++;
-      if (cell_v_[i] <= 2.) {
-        not_connected++;
-      }
+  uint8_t alarm = 0;
+  for (uint8_t i=0; i < 3; i++) {
+    if (cell_mv_[i] <= CELL_NOT_CONNECTED) {
+      alarm = 2;
+    } else if (cell_mv_[i] <= min_mv_ && alarm == 0) {
+      alarm = 1;
     }
   }
-  if (not_connected > 0) {
-    tone(buzz_, 440, 200);
-  } else if (alarm > 0) {
-    tone(buzz_, 1000);
-  } else {
-    noTone(buzz_);
+  if (alarm != alarm_) {
+    if (alarm == 2) {
+      buzzer_->play(buzzer_no_battery, BUZZER_PRIORITY_ALARM, true);
+    } else if (alarm == 1) {
+      buzzer_->play(buzzer_low_battery, BUZZER_PRIORITY_ALARM, true);
+    } else {
+      buzzer_->stop(BUZZER_PRIORITY_ALARM);
+    }
+  }
+  alarm_ = alarm;
+
+  unsigned long now = millis();
+
+  // Discharge log
+  if (log_length_ == 0 || now - log_time_[log_head_] >= BATTERY_LOG_PERIOD) {
+    if (log_length_ > 0) {
+      log_head_ = (log_head_ + 1) % BATTERY_LOG_SIZE;
+    }
+    if (log_length_ < BATTERY_LOG_SIZE) {
+      log_length_++;
+    }
+    log_time_[log_head_] = now;
+    log_charge_[log_head_] = charge_from_voltage(min(cell_mv_[0],
+                                                     min(cell_mv_[1], cell_mv_[2])));
   }
 }
 
 float BatteryMonitor::get_cell1_voltage() {
-  return cell_v_[0];
+  return started_ ? cell_mv_[0] * 0.001 : NAN;
 }
 
 float BatteryMonitor::get_cell2_voltage() {
-  return cell_v_[1];
+  return started_ ? cell_mv_[1] * 0.001 : NAN;
 }
 
 float BatteryMonitor::get_cell3_voltage() {
-  return cell_v_[2];
+  return started_ ? cell_mv_[2] * 0.001 : NAN;
 }
 
 float BatteryMonitor::get_total_voltage() {
-  return cell_v_[0]+cell_v_[1]+cell_v_[2];
+  return get_cell1_voltage() + get_cell2_voltage() + get_cell3_voltage();
+}
+
+float BatteryMonitor::get_state_of_charge() {
+  if (!started_) {
+    return NAN;
+  }
+  int mv = min(cell_mv_[0], min(cell_mv_[1], cell_mv_[2]));
+  return charge_from_voltage(mv) * 0.001;
+}
+
+float BatteryMonitor::get_time_to_empty() {
+  if (log_length_ < 2) {
+    return INFINITY;
+  }
+  uint8_t oldest = (log_head_ + BATTERY_LOG_SIZE + 1 - log_length_) % BATTERY_LOG_SIZE;
+  float used = log_charge_[oldest] - log_charge_[log_head_];
+  if (used <= 0.) {
+    return INFINITY;
+  }
+  float duration = (log_time_[log_head_] - log_time_[oldest]) * 0.001;
+  return get_state_of_charge() * 1000. * duration / used;
+}
+
+uint8_t BatteryMonitor::get_log_length() {
+  return log_length_;
+}
+
+char BatteryMonitor::get_log_entry(uint8_t i, unsigned long *time,
+                                   float *charge) {
+  if (i >= log_length_) {
+    return -1;
+  }
+  uint8_t k = (log_head_ + BATTERY_LOG_SIZE + 1 - log_length_ + i) % BATTERY_LOG_SIZE;
+  *time = log_time_[k];
+  *charge = log_charge_[k] * 0.001;
+  return 0;
+}
+
+char BatteryMonitor::check_battery(float min_charge) {
+  if (!started_ || alarm_ != 0) {
+    return -1;
+  }
+  if (get_state_of_charge() < min_charge) {
+    return -1;
+  }
+  return 0;
 }
@@ -10,8 +10,21 @@
 #define __BATTERY_MONITOR_H
 
 #include <Arduino.h>
+#include <avr/pgmspace.h>
 #include <scheduler.h>
 #include <math.h>
+#include "adc_scanner.h"
+#include "buzzer.h"
+
+// Time constant of the voltage filter, in periods: 2^BATTERY_FILTER_SHIFT
+#define BATTERY_FILTER_SHIFT 4
+
+// Number of entries of the discharge log and period between two of them in
+// milliseconds (the log covers the last 160s)
+#define BATTERY_LOG_SIZE 16
+#define BATTERY_LOG_PERIOD 10000UL
+
+class Propulsion;
 
 class BatteryMonitor : public ScheduledTask {
  public:
@@ -20,31 +33,109 @@ class BatteryMonitor : public ScheduledTask {
   // Parameters:
   //  - minimum_voltage: minimum voltage a cell has to reach to trigger an
   //                     alarm.
-  //  - period: period of the odometer update in microseconds
+  //  - cell1_pin, cell2_pin, cell3_pin: analog pins measuring the cells.
+  //                     They are added to the AdcScanner list, the values
+  //                     are read from it once it is started.
+  //  - buzzer: Buzzer sequencer playing the alarms (with the alarm
+  //            priority). It cannot be NULL.
+  //  - period: period of the odometer update in microseconds. The update
+  //            only costs a few integer operations and can run at 50Hz.
   BatteryMonitor(float minimum_voltage,
                  uint8_t cell1_pin,
                  uint8_t cell2_pin,
                  uint8_t cell3_pin,
-                 uint8_t buzzer_pin,
+                 Buzzer *buzzer,
                  unsigned long period);
 
   // Destructor
   //  Does nothing
   virtual ~BatteryMonitor() {};
 
+  // void set_load_compensation(Propulsion *propulsion, float sag):
+  //  Compensate the voltage drop caused by the motors' current, so that
+  //  accelerations do not trigger false alarms.
+  // Parameters:
+  //  - propulsion: Propulsion object driving the motors
+  //  - sag: voltage drop of each cell per motor driven at full duty cycle
+  //         (in volts, zero disables the compensation)
+  void set_load_compensation(Propulsion *propulsion, float sag);
+
   // virtual void run():
   //  Main loop
   virtual void run();
 
   // Accessor methods
+  //  Filtered voltages, compensated for the motors' load, in volts
   float get_cell1_voltage();
   float get_cell2_voltage();
   float get_cell3_voltage();
   float get_total_voltage();
 
+  // float get_state_of_charge():
+  //  Return the state of charge of the battery in [0; 1], estimated from
+  //  the open circuit voltage of its weakest cell (LiPo discharge curve).
+  float get_state_of_charge();
+
+  // float get_time_to_empty():
+  //  Return the time before the battery is empty in seconds, extrapolated
+  //  from the discharge log, or INFINITY if it is not discharging.
+  float get_time_to_empty();
+
+  // uint8_t get_log_length():
+  // char get_log_entry(uint8_t i, unsigned long *time, float *charge):
+  //  Access the discharge log: one entry every BATTERY_LOG_PERIOD.
+  // Parameters:
+  //  - i: index of the entry, 0 being the oldest one
+  //  - time: pointer to the variable in which to store the time of the
+  //          entry (millis())
+  //  - charge: pointer to the variable in which to store the state of
+  //            charge at that time
+  // Return value:
+  //  -1 if there is no such entry.
+  //  Zero if no error is encountered.
+  uint8_t get_log_length();
+  char get_log_entry(uint8_t i, unsigned long *time, float *charge);
+
+  // char check_battery(float min_charge):
+  //  Pre-match check, to be done with the motors stopped.
+  // Parameters:
+  //  - min_charge: state of charge required, in [0; 1]
+  // Return value:
+  //  -1 if a cell is not connected or too low, or if the state of charge
+  //  is below min_charge.
+  //  Zero if the battery is fine.
+  char check_battery(float min_charge);
+
  protected:
-  float min_voltage_, cell_v_[3];
-  uint8_t cell_pins_[3], buzz_;
+  // int read_cell(uint8_t cell):
+  //  Return the ADC value of a cell, from the scanner if it is running.
+  int read_cell(uint8_t cell);
+
+  // static int charge_from_voltage(int mv):
+  //  Return the state of charge (in per mille) corresponding to an open
+  //  circuit cell voltage in millivolts.
+  static int charge_from_voltage(int mv);
+
+  // Filtered ADC values (scaled by 64), compensated cell voltages and
+  // alarm threshold in millivolts
+  uint16_t filtered_[3];
+  int cell_mv_[3], min_mv_;
+  uint8_t cell_pins_[3];
+  char cell_channels_[3];
+  boolean started_;
+
+  // Load compensation: millivolts per unit of total duty, times 256
+  Propulsion *propulsion_;
+  unsigned int sag_;
+
+  // Alarm state
+  Buzzer *buzzer_;
+  uint8_t alarm_;
+
+  // Discharge log
+  unsigned long log_time_[BATTERY_LOG_SIZE];
+  int log_charge_[BATTERY_LOG_SIZE];
+  uint8_t log_head_, log_length_;
 };
 
 #endif // __BATTERY_MONITOR_H
@@ -0,0 +1,127 @@
+/************************************************************************
+ * File : button_pad.cpp                                                *
+ *  Class to debounce push buttons and queue their events.              *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "button_pad.h"
+
+ButtonPad::ButtonPad(unsigned long period) :
+            ScheduledTask(period, 0) {
+  n_ports_ = 0;
+  n_buttons_ = 0;
+  head_ = 0;
+  length_ = 0;
+  set_hold_times(DEFAULT_LONG_PRESS_TIME, DEFAULT_REPEAT_TIME);
+}
+
+char ButtonPad::begin(const uint8_t *pins, uint8_t n_buttons) {
+  if (n_buttons > BUTTON_PAD_MAX_BUTTONS) {
+    return -1;
+  }
+
+  n_ports_ = 0;
+  for (uint8_t i=0; i < n_buttons; i++) {
+    pinMode(pins[i], INPUT_PULLUP);
+
+    // Buttons sharing the same port are read with a single access
+    volatile uint8_t *in = portInputRegister(digitalPinToPort(pins[i]));
+    uint8_t p = 0;
+    while (p < n_ports_ && ports_[p] != in) {
+      p++;
+    }
+    if (p == n_ports_) {
+      if (n_ports_ >= BUTTON_PAD_MAX_PORTS) {
+        return -1;
+      }
+      ports_[n_ports_++] = in;
+    }
+    port_[i] = p;
+    mask_[i] = digitalPinToBitMask(pins[i]);
+    hold_[i] = 0;
+  }
+  n_buttons_ = n_buttons;
+
+  state_ = 0;
+  ct0_ = 0xFF;
+  ct1_ = 0xFF;
+  head_ = 0;
+  length_ = 0;
+
+  // start task now that the object has been initialized
+  start_task();
+
+  return 0;
+}
+
+void ButtonPad::set_hold_times(unsigned int long_press, unsigned int repeat) {
+  long_press_ = max(1UL, long_press * 1000UL / period_);
+  repeat_ = repeat * 1000UL / period_;
+  if (repeat > 0 && repeat_ == 0) {
+    repeat_ = 1;
+  }
+}
+
+char ButtonPad::read_event(ButtonEvent *event) {
+  if (length_ == 0) {
+    return -1;
+  }
+  uint8_t tail = (head_ + BUTTON_PAD_QUEUE_SIZE - length_) % BUTTON_PAD_QUEUE_SIZE;
+  *event = queue_[tail];
+  length_--;
+  return 0;
+}
+
+boolean ButtonPad::is_pressed(uint8_t button) {
+  return (state_ >> button) & 0x01;
+}
+
+void ButtonPad::push_event(uint8_t button, uint8_t type) {
+  if (length_ >= BUTTON_PAD_QUEUE_SIZE) {
+    return;
+  }
+  queue_[head_].button = button;
+  queue_[head_].type = type;
+  head_ = (head_ + 1) % BUTTON_PAD_QUEUE_SIZE;
+  length_++;
+}
+
+void ButtonPad::run() {
+  // Read each port once
+  uint8_t levels[BUTTON_PAD_MAX_PORTS];
+  for (uint8_t p=0; p < n_ports_; p++) {
+    levels[p] = *ports_[p];
+  }
+  uint8_t sample = 0;
+  for (uint8_t i=0; i < n_buttons_; i++) {
+    if (!(levels[port_[i]] & mask_[i])) {
+      sample |= 1 << i;
+    }
+  }
+
+  // Vertical counters: the state of a button toggles once its new level
+  // has been seen 4 times in a row, all buttons being processed at once
+  uint8_t changed = state_ ^ sample;
+  ct0_ = ~(ct0_ & changed);
+  ct1_ = ct0_ ^ (ct1_ & changed);
+  changed &= ct0_ & ct1_;
+  state_ ^= changed;
+
+  for (uint8_t i=0; i < n_buttons_; i++) {
+    uint8_t bit = 1 << i;
+    if (changed & bit) {
+      hold_[i] = 0;
+      push_event(i, state_ & bit ? ButtonEvent::press : ButtonEvent::release);
+    } else if (state_ & bit) {
+      hold_[i]++;
+      if (hold_[i] == long_press_) {
+        push_event(i, ButtonEvent::long_press);
+      } else if (repeat_ > 0 && hold_[i] >= long_press_ + repeat_) {
+        push_event(i, ButtonEvent::repeat);
+        hold_[i] = long_press_;
+      }
+    }
+  }
+}
@@ -0,0 +1,111 @@
+/************************************************************************
+ * File : button_pad.h                                                  *
+ *  Class to debounce push buttons and queue their events.              *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __BUTTON_PAD_H
+#define __BUTTON_PAD_H
+
+#include <Arduino.h>
+#include <scheduler.h>
+
+// Maximum number of buttons, and of different ports they can be on
+#define BUTTON_PAD_MAX_BUTTONS 8
+#define BUTTON_PAD_MAX_PORTS 3
+
+// Number of events which can wait to be read
+#define BUTTON_PAD_QUEUE_SIZE 8
+
+// Default times (in milliseconds) after which a held button generates a
+// long press event, then repeat events
+#define DEFAULT_LONG_PRESS_TIME 800
+#define DEFAULT_REPEAT_TIME 200
+
+// Event of a button
+struct ButtonEvent {
+  enum event_type {
+    press = 0,
+    release,
+    long_press,
+    repeat
+  };
+  uint8_t button;  // index of the button
+  uint8_t type;    // event_type
+};
+
+class ButtonPad : public ScheduledTask {
+ public:
+  // Constructor
+  //  Build a new button pad
+  // Parameters:
+  //  - period: period between two scans of the buttons in microseconds. A
+  //            level has to be seen on 4 consecutive scans to be accepted.
+  ButtonPad(unsigned long period);
+
+  // Destructor
+  //  Does nothing
+  virtual ~ButtonPad() {};
+
+  // char begin(const uint8_t *pins, uint8_t n_buttons):
+  //  Configure the pins of the buttons (active low, with pull-ups) and
+  //  start scanning them.
+  // Parameters:
+  //  - pins: array of the pins of the buttons, their index in this array
+  //          is the index used in the events
+  //  - n_buttons: number of buttons (at most BUTTON_PAD_MAX_BUTTONS)
+  // Return value:
+  //  -1 if there are too many buttons or if they are on more than
+  //  BUTTON_PAD_MAX_PORTS ports.
+  //  Zero if no error is encountered.
+  char begin(const uint8_t *pins, uint8_t n_buttons);
+
+  // void set_hold_times(unsigned int long_press, unsigned int repeat):
+  //  Change the times after which a held button generates events.
+  // Parameters:
+  //  - long_press: time before the long press event in milliseconds
+  //  - repeat: time between the repeat events following it in milliseconds
+  //            (zero disables them)
+  void set_hold_times(unsigned int long_press, unsigned int repeat);
+
+  // char read_event(ButtonEvent *event):
+  //  Get the oldest event not read yet.
+  // Parameters:
+  //  - event: pointer to the structure in which to store the event
+  // Return value:
+  //  -1 if there is no event to read.
+  //  Zero if no error is encountered.
+  char read_event(ButtonEvent *event);
+
+  // boolean is_pressed(uint8_t button):
+  //  Return the debounced state of a button.
+  boolean is_pressed(uint8_t button);
+
+  // virtual void run():
+  //  Scan the buttons.
+  virtual void run();
+
+ protected:
+  // void push_event(uint8_t button, uint8_t type):
+  //  Add an event to the queue, dropping it if the queue is full.
+  void push_event(uint8_t button, uint8_t type);
+
+  volatile uint8_t *ports_[BUTTON_PAD_MAX_PORTS];
+  uint8_t n_ports_, n_buttons_;
+  uint8_t port_[BUTTON_PAD_MAX_BUTTONS], mask_[BUTTON_PAD_MAX_BUTTONS];
+
+  // Debounced state (one bit per button, 1 when pressed) and vertical
+  // counters: bit i of ct0_ and ct1_ form the 2 bits counter of button i
+  uint8_t state_, ct0_, ct1_;
+
+  // Hold times in scans
+  unsigned int hold_[BUTTON_PAD_MAX_BUTTONS];
+  unsigned int long_press_, repeat_;
+
+  ButtonEvent queue_[BUTTON_PAD_QUEUE_SIZE];
+  uint8_t head_, length_;
+};
+
+#endif // __BUTTON_PAD_H
@@ -0,0 +1,143 @@
+/************************************************************************
+ * File : buzzer.cpp                                                    *
+ *  Non blocking sequencer playing prioritized patterns on a buzzer.    *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It owns TIMER2 (as tone() does), so tone() and PWM on pins 9 and 10  *
+ * cannot be used along with it. HBridge never puts PWM on these pins,  *
+ * it drives the other input of the bridge instead.                     *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "buzzer.h"
+
+// Half of the timer clock (16MHz / 128): output frequency for a compare
+// value of 0
+#define BUZZER_TIMER_FREQUENCY 62500UL
+
+const BuzzerNote buzzer_beep[] PROGMEM = {
+  {2000, 50}, {0, 0}
+};
+const BuzzerNote buzzer_double_beep[] PROGMEM = {
+  {2000, 50}, {0, 50}, {2000, 50}, {0, 0}
+};
+const BuzzerNote buzzer_error[] PROGMEM = {
+  {500, 150}, {0, 50}, {300, 300}, {0, 0}
+};
+const BuzzerNote buzzer_low_battery[] PROGMEM = {
+  {1000, 400}, {0, 100}, {0, 0}
+};
+const BuzzerNote buzzer_no_battery[] PROGMEM = {
+  {440, 200}, {0, 800}, {0, 0}
+};
+
+volatile uint8_t *Buzzer::pin_reg_ = NULL;
+uint8_t Buzzer::pin_mask_ = 0;
+
+Buzzer::Buzzer(unsigned long period) :
+            ScheduledTask(period, 0) {
+  pattern_ = NULL;
+  priority_ = 0;
+}
+
+void Buzzer::begin(uint8_t pin) {
+  pin_ = pin;
+  pinMode(pin_, OUTPUT);
+  digitalWrite(pin_, LOW);
+  pin_reg_ = portInputRegister(digitalPinToPort(pin_));
+  pin_mask_ = digitalPinToBitMask(pin_);
+
+  // CTC mode, 125kHz timer clock, interrupt disabled until a note is played
+  uint8_t oldSREG = SREG;
+  cli();
+  TIMSK2 = 0;
+  TCCR2A = _BV(WGM21);
+  TCCR2B = _BV(CS22) | _BV(CS20);
+  SREG = oldSREG;
+
+  pattern_ = NULL;
+  priority_ = 0;
+
+  // start task now that the object has been initialized
+  start_task();
+}
+
+char Buzzer::play(const BuzzerNote *pattern, uint8_t priority, boolean loop) {
+  if (pattern_ != NULL && priority_ > priority) {
+    return -1;
+  }
+
+  pattern_ = pattern;
+  priority_ = priority;
+  loop_ = loop;
+  note_ = 0;
+  start_note();
+
+  return 0;
+}
+
+void Buzzer::stop(uint8_t priority) {
+  if (pattern_ != NULL && priority_ <= priority) {
+    pattern_ = NULL;
+    priority_ = 0;
+    silence();
+  }
+}
+
+uint8_t Buzzer::get_priority() {
+  return priority_;
+}
+
+void Buzzer::silence() {
+  TIMSK2 &= ~_BV(OCIE2A);
+  digitalWrite(pin_, LOW);
+}
+
+void Buzzer::start_note() {
+  uint16_t duration = pgm_read_word(&pattern_[note_].duration);
+  if (duration == 0 && loop_ && note_ > 0) {
+    note_ = 0;
+    duration = pgm_read_word(&pattern_[note_].duration);
+  }
+  if (duration == 0) {
+    // End of the pattern
+    pattern_ = NULL;
+    priority_ = 0;
+    silence();
+    return;
+  }
+
+  uint16_t frequency = pgm_read_word(&pattern_[note_].frequency);
+  if (frequency == 0) {
+    silence();
+  } else {
+    // Only the compare value changes from one note to the other
+    unsigned long ocr = BUZZER_TIMER_FREQUENCY / frequency;
+    ocr = constrain(ocr, 1, 256);
+    uint8_t oldSREG = SREG;
+    cli();
+    OCR2A = ocr - 1;
+    TCNT2 = 0;
+    TIMSK2 |= _BV(OCIE2A);
+    SREG = oldSREG;
+  }
+
+  note_start_ = millis();
+  note_duration_ = duration;
+}
+
+void Buzzer::run() {
+  if (pattern_ != NULL && millis() - note_start_ >= note_duration_) {
+    note_++;
+    start_note();
+  }
+}
+
+void Buzzer::toggle() {
+  // Writing a one to the input register toggles the output
+  *pin_reg_ = pin_mask_;
+}
+
+ISR(TIMER2_COMPA_vect) {
+  Buzzer::toggle();
+}
@@ -0,0 +1,110 @@
+/************************************************************************
+ * File : buzzer.h                                                      *
+ *  Non blocking sequencer playing prioritized patterns on a buzzer.    *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It owns TIMER2 (as tone() does), so tone() and PWM on pins 9 and 10  *
+ * cannot be used along with it. HBridge never puts PWM on these pins,  *
+ * it drives the other input of the bridge instead.                     *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __BUZZER_H
+#define __BUZZER_H
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include <scheduler.h>
+
+// Priorities of the patterns: a pattern can only be interrupted by a
+// pattern of the same or of a higher priority
+#define BUZZER_PRIORITY_UI 1
+#define BUZZER_PRIORITY_WARNING 2
+#define BUZZER_PRIORITY_ALARM 3
+
+// Note of a pattern. Patterns are arrays of notes stored in program memory
+// (PROGMEM) and terminated by a note of zero duration.
+struct BuzzerNote {
+  uint16_t frequency; // in Hz (245Hz to 62.5kHz), 0 for a silence
+  uint16_t duration;  // in milliseconds
+};
+
+// Patterns provided by the library
+extern const BuzzerNote buzzer_beep[] PROGMEM;         // short UI beep
+extern const BuzzerNote buzzer_double_beep[] PROGMEM;  // UI confirmation
+extern const BuzzerNote buzzer_error[] PROGMEM;        // UI error
+extern const BuzzerNote buzzer_low_battery[] PROGMEM;  // cell voltage low
+extern const BuzzerNote buzzer_no_battery[] PROGMEM;   // cell not connected
+
+class Buzzer : public ScheduledTask {
+ public:
+  // Constructor
+  //  Build a new sequencer
+  // Parameters:
+  //  - period: period of the sequencer update in microseconds, which is
+  //            the time resolution of the notes
+  Buzzer(unsigned long period);
+
+  // Destructor
+  //  Does nothing
+  virtual ~Buzzer() {};
+
+  // void begin(uint8_t pin):
+  //  Configure the timer once for all and start the sequencer.
+  // Parameters:
+  //  - pin: pin of the buzzer (BUZZER)
+  void begin(uint8_t pin);
+
+  // char play(const BuzzerNote *pattern, uint8_t priority, boolean loop):
+  //  Start playing a pattern. This only records the request, the notes are
+  //  played by the task.
+  // Parameters:
+  //  - pattern: pattern stored in program memory
+  //  - priority: priority of the pattern (BUZZER_PRIORITY_*)
+  //  - loop: if true, the pattern is repeated until stop() is called or a
+  //          pattern of the same or of a higher priority is played
+  // Return value:
+  //  -1 if a pattern of higher priority is playing (the request is
+  //  ignored).
+  //  Zero if no error is encountered.
+  char play(const BuzzerNote *pattern, uint8_t priority, boolean loop = false);
+
+  // void stop(uint8_t priority):
+  //  Stop the current pattern if its priority is not higher than the given
+  //  one.
+  void stop(uint8_t priority);
+
+  // uint8_t get_priority():
+  //  Return the priority of the pattern being played, zero if the buzzer
+  //  is silent.
+  uint8_t get_priority();
+
+  // virtual void run():
+  //  Play the notes of the current pattern.
+  virtual void run();
+
+  // static void toggle():
+  //  For internal use by the interrupt vector: toggles the buzzer pin.
+  static void toggle();
+
+ protected:
+  // void start_note():
+  //  Output the current note of the pattern.
+  void start_note();
+
+  // void silence():
+  //  Stop the output and leave the pin low.
+  void silence();
+
+  const BuzzerNote *pattern_;
+  uint8_t note_, priority_;
+  boolean loop_, restart_;
+  unsigned long note_start_, note_duration_;
+  uint8_t pin_;
+
+  // Accessed by the interrupt
+  static volatile uint8_t *pin_reg_;
+  static uint8_t pin_mask_;
+};
+
+#endif // __BUZZER_H
@@ -0,0 +1,150 @@
+/************************************************************************
+ * File : extension_board.cpp                                           *
+ *  Detection of the extension board and access to its channels.       *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "extension_board.h"
+
+ExtensionBoard::ExtensionBoard() {
+  n_modules_ = 0;
+  module_ = NULL;
+  present_ = false;
+  det_level_ = 1023;
+  for (uint8_t i=0; i < EXT_CHANNELS; i++) {
+    channels_[i].pin = 0;
+    channels_[i].type = unused;
+    channels_[i].adc_channel = -1;
+    channels_[i].gain = 1.;
+    channels_[i].offset = 0.;
+  }
+}
+
+char ExtensionBoard::add_module(ExtensionModule *module) {
+  if (n_modules_ >= EXT_MAX_MODULES) {
+    return -1;
+  }
+  modules_[n_modules_++] = module;
+  return 0;
+}
+
+char ExtensionBoard::begin(uint8_t det_pin, uint8_t s1_pin, uint8_t s2_pin) {
+  channels_[0].pin = s1_pin;
+  channels_[1].pin = s2_pin;
+
+  // The board pulls EXT_DET down against the pull-up
+  pinMode(det_pin, INPUT_PULLUP);
+  if (AdcScanner::is_running()) {
+    // The value of a new channel is valid after the next complete scan
+    char c = AdcScanner::add_channel(det_pin);
+    unsigned int scan = AdcScanner::get_scan_count();
+    while (c >= 0 && (unsigned int)(AdcScanner::get_scan_count() - scan) < 2) ;
+    det_level_ = c >= 0 ? AdcScanner::read(c) : 1023;
+  } else {
+    unsigned int sum = 0;
+    for (uint8_t i=0; i < EXT_DETECT_SAMPLES; i++) {
+      sum += analogRead(det_pin);
+    }
+    det_level_ = sum / EXT_DETECT_SAMPLES;
+  }
+  present_ = det_level_ < EXT_NO_BOARD_LEVEL;
+  module_ = NULL;
+  if (!present_) {
+    return -1;
+  }
+
+  for (uint8_t i=0; i < n_modules_; i++) {
+    if (modules_[i]->detect(det_level_)) {
+      module_ = modules_[i];
+      module_->attach(this);
+      return i;
+    }
+  }
+  return -1;
+}
+
+boolean ExtensionBoard::is_present() {
+  return present_;
+}
+
+int ExtensionBoard::get_detect_level() {
+  return det_level_;
+}
+
+ExtensionModule *ExtensionBoard::get_module() {
+  return module_;
+}
+
+char ExtensionBoard::configure_channel(uint8_t ch,
+                                       ExtensionBoard::channel_type type,
+                                       float gain, float offset) {
+  if (ch >= EXT_CHANNELS) {
+    return -1;
+  }
+  Channel *c = &channels_[ch];
+
+  switch (type) {
+    case analog:
+      pinMode(c->pin, INPUT);
+      c->adc_channel = AdcScanner::add_channel(c->pin);
+      if (c->adc_channel < 0) {
+        return -1;
+      }
+      break;
+    case digital:
+      pinMode(c->pin, INPUT);
+      break;
+    case digital_pullup:
+      pinMode(c->pin, INPUT_PULLUP);
+      break;
+    default:
+      break;
+  }
+  c->type = type;
+  c->gain = gain;
+  c->offset = offset;
+
+  return 0;
+}
+
+ExtensionBoard::channel_type ExtensionBoard::get_channel_type(uint8_t ch) {
+  return ch < EXT_CHANNELS ? (channel_type)channels_[ch].type : unused;
+}
+
+int ExtensionBoard::read_raw(uint8_t ch) {
+  if (ch >= EXT_CHANNELS || channels_[ch].type != analog) {
+    return 0;
+  }
+  if (AdcScanner::is_running()) {
+    return AdcScanner::read(channels_[ch].adc_channel);
+  }
+  return analogRead(channels_[ch].pin);
+}
+
+float ExtensionBoard::read_voltage(uint8_t ch) {
+  return read_raw(ch) * (EXT_ADC_VREF / 1023.);
+}
+
+float ExtensionBoard::read_value(uint8_t ch) {
+  if (ch >= EXT_CHANNELS) {
+    return 0.;
+  }
+  return channels_[ch].gain * read_voltage(ch) + channels_[ch].offset;
+}
+
+uint8_t ExtensionBoard::read_level(uint8_t ch) {
+  if (ch >= EXT_CHANNELS || channels_[ch].type < digital) {
+    return LOW;
+  }
+  return digitalRead(channels_[ch].pin);
+}
+
+unsigned long ExtensionBoard::get_timestamp(uint8_t ch) {
+  if (ch >= EXT_CHANNELS || channels_[ch].type != analog
+      || !AdcScanner::is_running()) {
+    return 0;
+  }
+  return AdcScanner::get_timestamp(channels_[ch].adc_channel);
+}
@@ -0,0 +1,157 @@
+/************************************************************************
+ * File : extension_board.h                                             *
+ *  Detection of the extension board and access to its channels.       *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __EXTENSION_BOARD_H
+#define __EXTENSION_BOARD_H
+
+#include <Arduino.h>
+#include "adc_scanner.h"
+
+// Number of auxiliary channels of the extension connector (EXT_S1, EXT_S2)
+#define EXT_CHANNELS 2
+
+// Maximum number of module drivers which can be registered
+#define EXT_MAX_MODULES 4
+
+// EXT_DET is pulled up on the main board, a level above this one (on the
+// 10 bits scale) means that no board is plugged. Boards identify themselves
+// by pulling EXT_DET to a lower level.
+#define EXT_NO_BOARD_LEVEL 1000
+
+// Number of readings of EXT_DET averaged to detect the board
+#define EXT_DETECT_SAMPLES 8
+
+// Reference voltage of the ADC in volts
+#define EXT_ADC_VREF 5.
+
+class ExtensionBoard;
+
+class ExtensionModule {
+ public:
+  // Destructor
+  //  Does nothing
+  virtual ~ExtensionModule() {};
+
+  // virtual boolean detect(int level):
+  //  Return true if the plugged board is driven by this module.
+  // Parameters:
+  //  - level: averaged reading of EXT_DET on the 10 bits scale
+  virtual boolean detect(int level) = 0;
+
+  // virtual void attach(ExtensionBoard *board):
+  //  Called once when the module has been detected: configure the
+  //  channels and the other pins of the board.
+  // Parameters:
+  //  - board: pointer to the ExtensionBoard to configure
+  virtual void attach(ExtensionBoard *board) = 0;
+};
+
+class ExtensionBoard {
+ public:
+  enum channel_type {
+    unused = 0,
+    analog,         // sampled by the AdcScanner
+    digital,        // digital input
+    digital_pullup  // digital input with pull-up
+  };
+
+  // Constructor
+  //  Build a new extension board, no channel being configured
+  ExtensionBoard();
+
+  // char add_module(ExtensionModule *module):
+  //  Register the driver of a module. Drivers are tried in the order in
+  //  which they were registered.
+  // Return value:
+  //  -1 if no more modules can be registered.
+  //  Zero if no error is encountered.
+  char add_module(ExtensionModule *module);
+
+  // char begin(uint8_t det_pin, uint8_t s1_pin, uint8_t s2_pin):
+  //  Detect the extension board and attach the first registered module
+  //  recognizing it. It should be called before AdcScanner::begin() so
+  //  that the analog channels are part of the first scan.
+  // Parameters:
+  //  - det_pin: detection pin (EXT_DET)
+  //  - s1_pin, s2_pin: pins of the auxiliary channels (EXT_S1, EXT_S2)
+  // Return value:
+  //  -1 if no board is plugged or if no module recognized it.
+  //  Index of the attached module otherwise.
+  char begin(uint8_t det_pin, uint8_t s1_pin, uint8_t s2_pin);
+
+  // boolean is_present():
+  //  Return true if a board was detected by begin().
+  boolean is_present();
+
+  // int get_detect_level():
+  //  Return the averaged reading of EXT_DET taken by begin().
+  int get_detect_level();
+
+  // ExtensionModule *get_module():
+  //  Return the attached module, NULL if none.
+  ExtensionModule *get_module();
+
+  // char configure_channel(uint8_t ch, channel_type type,
+  //                        float gain, float offset):
+  //  Configure an auxiliary channel, usually from ExtensionModule::attach().
+  // Parameters:
+  //  - ch: index of the channel (0 for EXT_S1, 1 for EXT_S2)
+  //  - type: type of the channel
+  //  - gain, offset: conversion of the voltage of an analog channel to the
+  //                  value returned by read_value() (value = gain*V + offset)
+  // Return value:
+  //  -1 if the channel does not exist or cannot be sampled.
+  //  Zero if no error is encountered.
+  char configure_channel(uint8_t ch, channel_type type,
+                         float gain = 1., float offset = 0.);
+
+  // channel_type get_channel_type(uint8_t ch):
+  //  Return the type of a channel.
+  channel_type get_channel_type(uint8_t ch);
+
+  // int read_raw(uint8_t ch):
+  //  Return the last reading of an analog channel on the 10 bits scale.
+  //  The AdcScanner is used once it is running, so this never waits for a
+  //  conversion in a task.
+  int read_raw(uint8_t ch);
+
+  // float read_voltage(uint8_t ch):
+  //  Return the last reading of an analog channel in volts.
+  float read_voltage(uint8_t ch);
+
+  // float read_value(uint8_t ch):
+  //  Return the last reading of an analog channel converted with the gain
+  //  and offset of the channel.
+  float read_value(uint8_t ch);
+
+  // uint8_t read_level(uint8_t ch):
+  //  Return the level (HIGH or LOW) of a digital channel.
+  uint8_t read_level(uint8_t ch);
+
+  // unsigned long get_timestamp(uint8_t ch):
+  //  Return the time (micros()) of the last reading of an analog channel,
+  //  zero if the AdcScanner is not running.
+  unsigned long get_timestamp(uint8_t ch);
+
+ protected:
+  struct Channel {
+    uint8_t pin;
+    uint8_t type;
+    char adc_channel;
+    float gain, offset;
+  };
+
+  ExtensionModule *modules_[EXT_MAX_MODULES];
+  uint8_t n_modules_;
+  ExtensionModule *module_;
+  Channel channels_[EXT_CHANNELS];
+  boolean present_;
+  int det_level_;
+};
+
+#endif // __EXTENSION_BOARD_H
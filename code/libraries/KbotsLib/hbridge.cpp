@@ -0,0 +1,188 @@
+/************************************************************************
+ * File : hbridge.cpp                                                   *
+ *  Class to drive H-bridges with minimal pin writes.                   *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "hbridge.h"
+
+HBridge::HBridge() {
+  n_motors_ = 0;
+  halted_ = 0;
+}
+
+void HBridge::begin(uint8_t n_motors, const uint8_t *in1, const uint8_t *in2,
+                    const uint8_t *en) {
+  n_motors_ = min(n_motors, HBRIDGE_MAX_MOTORS);
+
+  for (uint8_t i=0; i < n_motors_; i++) {
+    OutputPin *pins[3] = {&in1_[i], &in2_[i], &en_[i]};
+    in1_[i].pin = in1[i];
+    in2_[i].pin = in2[i];
+    en_[i].pin = en[i];
+    for (uint8_t j=0; j < 3; j++) {
+      pinMode(pins[j]->pin, OUTPUT);
+      digitalWrite(pins[j]->pin, LOW);
+      pins[j]->out = portOutputRegister(digitalPinToPort(pins[j]->pin));
+      pins[j]->mask = digitalPinToBitMask(pins[j]->pin);
+      pins[j]->value = 0;
+      // TIMER2 is left to the Buzzer class (and tone())
+      uint8_t timer = digitalPinToTimer(pins[j]->pin);
+      pins[j]->pwm = timer != NOT_ON_TIMER
+                     && timer != TIMER2A && timer != TIMER2B;
+    }
+    state_[i] = coast;
+  }
+}
+
+void HBridge::set_state(uint8_t motor, HBridge::bridge_state state) {
+  if (halted_ || state_[motor] == state) {
+    return;
+  }
+  switch (state) {
+  case coast:
+    write_pin(&en_[motor], LOW);
+    break;
+  case brake_low:
+  case brake_high:
+    write_pin(&in1_[motor], state == brake_high);
+    write_pin(&in2_[motor], state == brake_high);
+    write_pin(&en_[motor], HIGH);
+    break;
+  case drive:
+    write_pin(&en_[motor], HIGH);
+    break;
+  }
+  state_[motor] = state;
+}
+
+void HBridge::set_all_states(HBridge::bridge_state state) {
+  OutputPin *ins[2*HBRIDGE_MAX_MOTORS], *ens[HBRIDGE_MAX_MOTORS];
+  uint8_t n_ins = 0, n_ens = 0;
+
+  if (halted_) {
+    return;
+  }
+  for (uint8_t i=0; i < n_motors_; i++) {
+    if (state_[i] == state) {
+      continue;
+    }
+    if (state == brake_low || state == brake_high) {
+      ins[n_ins++] = &in1_[i];
+      ins[n_ins++] = &in2_[i];
+    }
+    ens[n_ens++] = &en_[i];
+    state_[i] = state;
+  }
+
+  // Set inputs before enabling the bridges
+  write_pins(ins, n_ins, state == brake_high);
+  write_pins(ens, n_ens, state != coast);
+}
+
+void HBridge::set_duty(uint8_t motor, int duty) {
+  if (halted_ || state_[motor] == coast) {
+    return;
+  }
+  if (state_[motor] != drive) {
+    set_state(motor, drive);
+  }
+  if (duty >= 0) {
+    drive_pins(&in1_[motor], &in2_[motor], duty);
+  } else {
+    drive_pins(&in2_[motor], &in1_[motor], -duty);
+  }
+}
+
+HBridge::bridge_state HBridge::get_state(uint8_t motor) {
+  return state_[motor];
+}
+
+void HBridge::halt() {
+  uint8_t oldSREG = SREG;
+  cli();
+  halted_ = 1;
+  // The enables are never PWM outputs
+  for (uint8_t i=0; i < n_motors_; i++) {
+    *en_[i].out &= ~en_[i].mask;
+  }
+  SREG = oldSREG;
+}
+
+void HBridge::write_pin(HBridge::OutputPin *p, uint8_t high) {
+  if (p->value == (high ? 255 : 0)) {
+    return;
+  }
+  write_pins(&p, 1, high);
+}
+
+void HBridge::write_pwm(HBridge::OutputPin *p, int duty) {
+  if (p->value == duty) {
+    return;
+  }
+  analogWrite(p->pin, duty);
+  p->value = duty;
+}
+
+void HBridge::drive_pins(HBridge::OutputPin *in, HBridge::OutputPin *other,
+                         int duty) {
+  if (!in->pwm && other->pwm) {
+    // Hold the input high and brake high during the off time
+    write_pin(in, HIGH);
+    write_pwm(other, 255 - duty);
+  } else {
+    write_pin(other, LOW);
+    write_pwm(in, duty);
+  }
+}
+
+void HBridge::write_pins(HBridge::OutputPin **pins, uint8_t n, uint8_t high) {
+  volatile uint8_t *ports[2*HBRIDGE_MAX_MOTORS];
+  uint8_t masks[2*HBRIDGE_MAX_MOTORS];
+  uint8_t n_ports = 0;
+  int value = high ? 255 : 0;
+
+  // Gather pins by port
+  for (uint8_t i=0; i < n; i++) {
+    OutputPin *p = pins[i];
+    if (p->value == value) {
+      continue;
+    }
+    if (p->value != 0 && p->value != 255) {
+      // PWM output, the timer has to be disconnected by the core
+      digitalWrite(p->pin, high ? HIGH : LOW);
+    } else {
+      uint8_t j = 0;
+      while (j < n_ports && ports[j] != p->out) j++;
+      if (j == n_ports) {
+        ports[n_ports] = p->out;
+        masks[n_ports] = 0;
+        n_ports++;
+      }
+      masks[j] |= p->mask;
+    }
+    p->value = value;
+  }
+
+  // One write per port
+  if (n_ports == 0) {
+    return;
+  }
+  uint8_t oldSREG = SREG;
+  cli();
+  // A halt may have happened since the caller checked it
+  if (high && halted_) {
+    SREG = oldSREG;
+    return;
+  }
+  for (uint8_t j=0; j < n_ports; j++) {
+    if (high) {
+      *ports[j] |= masks[j];
+    } else {
+      *ports[j] &= ~masks[j];
+    }
+  }
+  SREG = oldSREG;
+}
@@ -0,0 +1,111 @@
+/************************************************************************
+ * File : hbridge.h                                                     *
+ *  Class to drive H-bridges with minimal pin writes.                   *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __HBRIDGE_H
+#define __HBRIDGE_H
+
+#include <Arduino.h>
+
+// Maximum number of bridges which can be managed by one object
+#define HBRIDGE_MAX_MOTORS 4
+
+class HBridge {
+ public:
+  // Enumeration for the bridges' state machine
+  //  - coast: enable pin low, the motor is free rolling
+  //  - brake_low, brake_high: enable pin high, both inputs low (resp. high)
+  //  - drive: enable pin high, one input low and PWM on the other one. If
+  //           the input to PWM is on TIMER2 (owned by the Buzzer class), it
+  //           is held high and the other input gets the inverted PWM, so
+  //           the motor brakes high instead of low during the off time.
+  enum bridge_state {
+    coast = 0,
+    brake_low,
+    brake_high,
+    drive
+  };
+
+  // Constructor:
+  //  Builds a new HBridge object
+  HBridge();
+
+  // void begin(uint8_t n_motors, const uint8_t *in1, const uint8_t *in2,
+  //            const uint8_t *en):
+  //  Initialize the pins of all the bridges. All bridges start coasting with
+  //  all pins low.
+  // Parameters:
+  //  - n_motors: number of bridges (at most HBRIDGE_MAX_MOTORS)
+  //  - in1, in2: arrays of the pin numbers of the bridges' inputs (PWM pins,
+  //              at most one input of a bridge on TIMER2)
+  //  - en: array of the pin numbers of the bridges' enables
+  void begin(uint8_t n_motors, const uint8_t *in1, const uint8_t *in2,
+             const uint8_t *en);
+
+  // void set_state(uint8_t motor, bridge_state state):
+  //  Change the state of one bridge. Nothing is written if the bridge is
+  //  already in this state.
+  void set_state(uint8_t motor, bridge_state state);
+
+  // void set_all_states(bridge_state state):
+  //  Change the state of all the bridges. Pins sharing the same port are
+  //  updated with a single port write.
+  void set_all_states(bridge_state state);
+
+  // void set_duty(uint8_t motor, int duty):
+  //  Drive one motor. The bridge goes to the drive state unless it is
+  //  coasting, in which case the command is ignored.
+  // Parameters:
+  //  - motor: index of the bridge
+  //  - duty: signed duty cycle in [-255; 255]. Only the pins whose output
+  //          actually changes are written.
+  void set_duty(uint8_t motor, int duty);
+
+  // bridge_state get_state(uint8_t motor):
+  //  Return the current state of one bridge.
+  bridge_state get_state(uint8_t motor);
+
+  // void halt():
+  //  Pull the enables of all the bridges low at once and keep them low
+  //  until the next reset: no pin is written high afterwards. This can be
+  //  called from an interrupt.
+  void halt();
+
+ protected:
+  // Shadow of an output pin
+  struct OutputPin {
+    uint8_t pin, mask;
+    volatile uint8_t *out;
+    int value;       // 0 (low), 255 (high) or PWM duty
+    uint8_t pwm;     // PWM can be used on this pin
+  };
+
+  // void write_pin(OutputPin *p, uint8_t high):
+  //  Write a static level on a pin if it changed.
+  void write_pin(OutputPin *p, uint8_t high);
+
+  // void write_pwm(OutputPin *p, int duty):
+  //  Write a duty cycle on a pin if it changed.
+  void write_pwm(OutputPin *p, int duty);
+
+  // void drive_pins(OutputPin *in, OutputPin *other, int duty):
+  //  Drive a motor with a duty cycle in [0; 255] on the in input, or with
+  //  the inverted duty cycle on the other one if PWM cannot be used on in.
+  void drive_pins(OutputPin *in, OutputPin *other, int duty);
+
+  // void write_pins(OutputPin **pins, uint8_t n, uint8_t high):
+  //  Write the same static level on several pins, grouping writes by port.
+  void write_pins(OutputPin **pins, uint8_t n, uint8_t high);
+
+  OutputPin in1_[HBRIDGE_MAX_MOTORS], in2_[HBRIDGE_MAX_MOTORS];
+  OutputPin en_[HBRIDGE_MAX_MOTORS];
+  bridge_state state_[HBRIDGE_MAX_MOTORS];
+  uint8_t n_motors_;
+  volatile uint8_t halted_;
+};
+
+#endif // __HBRIDGE_H
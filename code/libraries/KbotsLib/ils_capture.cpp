@@ -0,0 +1,132 @@
+/************************************************************************
+ * File : ils_capture.cpp                                               *
+ *  Timestamped edge capture for reed switches (ILS).                   *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * The ILS pins of the board (22 to 32) have no pin change interrupt,   *
+ * so they are sampled from the TIMER5 compare interrupt, which cannot  *
+ * be used by other libraries (Servo, or PWM on pins 44 to 46).         *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "ils_capture.h"
+
+IlsCapture::Switch IlsCapture::switches_[ILS_MAX_SWITCHES];
+uint8_t IlsCapture::n_switches_ = 0;
+uint8_t IlsCapture::debounce_ = DEFAULT_ILS_DEBOUNCE;
+unsigned int IlsCapture::half_period_ = DEFAULT_ILS_SAMPLE_PERIOD / 2;
+IlsEdge IlsCapture::queue_[ILS_QUEUE_SIZE];
+volatile uint8_t IlsCapture::head_ = 0;
+volatile uint8_t IlsCapture::tail_ = 0;
+volatile unsigned int IlsCapture::lost_ = 0;
+
+char IlsCapture::add_switch(uint8_t pin) {
+  if (n_switches_ >= ILS_MAX_SWITCHES) {
+    return -1;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  Switch *s = &switches_[n_switches_];
+  s->in = portInputRegister(digitalPinToPort(pin));
+  s->mask = digitalPinToBitMask(pin);
+  s->level = (*s->in & s->mask) ? HIGH : LOW;
+  s->count = 0;
+  s->quiet = 0;
+  n_switches_++;
+  SREG = oldSREG;
+
+  return n_switches_ - 1;
+}
+
+void IlsCapture::begin(unsigned int sample_period, uint8_t debounce) {
+  if (sample_period > 32767) {
+    sample_period = 32767;
+  }
+  debounce_ = debounce > 0 ? debounce : 1;
+  half_period_ = sample_period / 2;
+
+  // CTC mode, 2MHz timer clock
+  uint8_t oldSREG = SREG;
+  cli();
+  TCCR5A = 0;
+  TCCR5B = _BV(WGM52) | _BV(CS51);
+  OCR5A = 2 * sample_period - 1;
+  TCNT5 = 0;
+  TIMSK5 = _BV(OCIE5A);
+  SREG = oldSREG;
+}
+
+char IlsCapture::read_edge(IlsEdge *edge) {
+  uint8_t tail = tail_;
+  if (tail == head_) {
+    return -1;
+  }
+  // Compiler barriers: the slot is read after head_ and released only
+  // once copied, queue_ not being volatile
+  asm volatile("" ::: "memory");
+  *edge = queue_[tail];
+  asm volatile("" ::: "memory");
+  tail_ = (tail + 1) & (ILS_QUEUE_SIZE - 1);
+  return 0;
+}
+
+uint8_t IlsCapture::get_state(uint8_t sw) {
+  if (sw >= n_switches_) {
+    return LOW;
+  }
+  return switches_[sw].level;
+}
+
+unsigned int IlsCapture::get_lost_edges() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned int lost = lost_;
+  SREG = oldSREG;
+  return lost;
+}
+
+void IlsCapture::sample() {
+  unsigned long now = micros();
+
+  for (uint8_t i=0; i < n_switches_; i++) {
+    Switch *s = &switches_[i];
+    uint8_t level = (*s->in & s->mask) ? HIGH : LOW;
+
+    if (level != s->level) {
+      // Start of a transition, unless the switch is bouncing
+      if (s->count == 0 && s->quiet == 0) {
+        s->first = now;
+      }
+      s->quiet = 0;
+      s->count++;
+      if (s->count >= debounce_) {
+        s->level = level;
+        s->count = 0;
+        uint8_t head = head_, next = (head + 1) & (ILS_QUEUE_SIZE - 1);
+        if (next == tail_) {
+          lost_++;
+        } else {
+          // The edge happened between this sample and the previous one
+          queue_[head].sw = i;
+          queue_[head].level = level;
+          queue_[head].time = s->first - half_period_;
+          // Compiler barrier: the slot is written before being published
+          asm volatile("" ::: "memory");
+          head_ = next;
+        }
+      }
+    } else if (s->count > 0 || s->quiet > 0) {
+      // Bounce back to the current level: forget the transition if it lasts
+      s->count = 0;
+      s->quiet++;
+      if (s->quiet >= debounce_) {
+        s->quiet = 0;
+      }
+    }
+  }
+}
+
+ISR(TIMER5_COMPA_vect) {
+  IlsCapture::sample();
+}
@@ -0,0 +1,104 @@
+/************************************************************************
+ * File : ils_capture.h                                                 *
+ *  Timestamped edge capture for reed switches (ILS).                   *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * The ILS pins of the board (22 to 32) have no pin change interrupt,   *
+ * so they are sampled from the TIMER5 compare interrupt, which cannot  *
+ * be used by other libraries (Servo, or PWM on pins 44 to 46).         *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __ILS_CAPTURE_H
+#define __ILS_CAPTURE_H
+
+#include <Arduino.h>
+
+// Maximum number of switches
+#define ILS_MAX_SWITCHES 6
+
+// Number of edges which can wait to be read (power of 2)
+#define ILS_QUEUE_SIZE 16
+
+// Default sampling period in microseconds. At 0.5m/s, the robot moves by
+// 0.125mm between two samples.
+#define DEFAULT_ILS_SAMPLE_PERIOD 250
+
+// Default number of samples a new level has to be stable to be accepted
+#define DEFAULT_ILS_DEBOUNCE 4
+
+// Transition of a switch
+struct IlsEdge {
+  uint8_t sw;         // index of the switch
+  uint8_t level;      // new level (HIGH or LOW)
+  unsigned long time; // micros() of the transition
+};
+
+class IlsCapture {
+ public:
+  // static char add_switch(uint8_t pin):
+  //  Watch a switch. The pin has to be configured as an input beforehand.
+  // Parameters:
+  //  - pin: pin number (ILS_0..ILS_5, any digital pin can be used)
+  // Return value:
+  //  -1 if no more switches can be added.
+  //  Index of the switch otherwise.
+  static char add_switch(uint8_t pin);
+
+  // static void begin(unsigned int sample_period, uint8_t debounce):
+  //  Start sampling the switches.
+  // Parameters:
+  //  - sample_period: period between two samples in microseconds (at most
+  //                   32767)
+  //  - debounce: number of consecutive samples a new level has to be seen
+  //              before the edge is accepted. The edge is timestamped with
+  //              the first of them, so this does not delay the timestamp.
+  static void begin(unsigned int sample_period = DEFAULT_ILS_SAMPLE_PERIOD,
+                    uint8_t debounce = DEFAULT_ILS_DEBOUNCE);
+
+  // static char read_edge(IlsEdge *edge):
+  //  Get the oldest edge not read yet. Edges are stored from the interrupt
+  //  in a queue which does not need to disable interrupts to be read.
+  //  The position of the robot at the edge can be obtained with
+  //  Odometry::get_position_at(edge->time, ...).
+  // Parameters:
+  //  - edge: pointer to the structure in which to store the edge
+  // Return value:
+  //  -1 if there is no edge to read.
+  //  Zero if no error is encountered.
+  static char read_edge(IlsEdge *edge);
+
+  // static uint8_t get_state(uint8_t sw):
+  //  Return the debounced level of a switch.
+  static uint8_t get_state(uint8_t sw);
+
+  // static unsigned int get_lost_edges():
+  //  Return the number of edges dropped because the queue was full.
+  static unsigned int get_lost_edges();
+
+  // static void sample():
+  //  For internal use by the interrupt vector: samples all the switches.
+  static void sample();
+
+ protected:
+  struct Switch {
+    volatile uint8_t *in;
+    uint8_t mask;
+    uint8_t level;         // debounced level
+    uint8_t count;         // consecutive samples at the other level
+    uint8_t quiet;         // consecutive samples back at the level
+    unsigned long first;   // time the other level was first seen
+  };
+
+  static Switch switches_[ILS_MAX_SWITCHES];
+  static uint8_t n_switches_, debounce_;
+  static unsigned int half_period_;
+
+  // Single producer (interrupt) single consumer queue: head_ is only
+  // written by the interrupt and tail_ by the reader
+  static IlsEdge queue_[ILS_QUEUE_SIZE];
+  static volatile uint8_t head_, tail_;
+  static volatile unsigned int lost_;
+};
+
+#endif // __ILS_CAPTURE_H
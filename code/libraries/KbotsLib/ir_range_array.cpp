@@ -0,0 +1,129 @@
+/************************************************************************
+ * File : ir_range_array.cpp                                            *
+ *  Class to measure distances with Sharp IR range sensors.             *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "ir_range_array.h"
+
+IrRangeArray::IrRangeArray(unsigned long period) :
+            ScheduledTask(period, 0) {
+  n_sensors_ = 0;
+  n_readings_ = 0;
+  cur_reading_ = 0;
+  snapshot_.timestamp = 0;
+}
+
+void IrRangeArray::begin() {
+  n_readings_ = 0;
+  cur_reading_ = 0;
+
+  // start task now that the object has been initialized
+  start_task();
+}
+
+char IrRangeArray::add_sensor(uint8_t pin, const IrCalibrationPoint *table,
+                              uint8_t length) {
+  if (n_sensors_ >= IR_RANGE_MAX_SENSORS || length < 2) {
+    return -1;
+  }
+
+  Sensor *s = &sensors_[n_sensors_];
+  s->pin = pin;
+  s->channel = AdcScanner::add_channel(pin);
+  s->table = table;
+  s->length = length;
+  snapshot_.range[n_sensors_] = convert(table, length, 0);
+  n_sensors_++;
+
+  return n_sensors_ - 1;
+}
+
+float IrRangeArray::get_range(uint8_t sensor) {
+  if (sensor >= n_sensors_) {
+    return NAN;
+  }
+  return snapshot_.range[sensor];
+}
+
+float IrRangeArray::get_max_range(uint8_t sensor) {
+  if (sensor >= n_sensors_) {
+    return NAN;
+  }
+  return convert(sensors_[sensor].table, sensors_[sensor].length, 0);
+}
+
+const IrRangeSnapshot *IrRangeArray::get_snapshot() {
+  return &snapshot_;
+}
+
+uint8_t IrRangeArray::get_number_of_sensors() {
+  return n_sensors_;
+}
+
+float IrRangeArray::convert(const IrCalibrationPoint *table, uint8_t length,
+                            int adc) {
+  uint16_t a0 = pgm_read_word(&table[0].adc);
+  if (adc <= a0) {
+    return pgm_read_word(&table[0].distance) * 0.001;
+  }
+
+  for (uint8_t i=1; i < length; i++) {
+    uint16_t a1 = pgm_read_word(&table[i].adc);
+    if (adc <= a1) {
+      float d0 = pgm_read_word(&table[i-1].distance);
+      float d1 = pgm_read_word(&table[i].distance);
+      return (d0 + (d1 - d0) * (adc - a0) / (a1 - a0)) * 0.001;
+    }
+    a0 = a1;
+  }
+
+  return pgm_read_word(&table[length-1].distance) * 0.001;
+}
+
+int IrRangeArray::read_adc(uint8_t sensor) {
+  Sensor *s = &sensors_[sensor];
+  if (AdcScanner::is_running() && s->channel >= 0) {
+    return AdcScanner::read(s->channel);
+  }
+  return analogRead(s->pin);
+}
+
+int IrRangeArray::median(uint8_t sensor) {
+  // Insertion sort of a copy of the readings
+  int sorted[IR_RANGE_MEDIAN_SIZE];
+  int *readings = sensors_[sensor].readings;
+  for (uint8_t i=0; i < n_readings_; i++) {
+    int value = readings[i];
+    uint8_t j = i;
+    while (j > 0 && sorted[j-1] > value) {
+      sorted[j] = sorted[j-1];
+      j--;
+    }
+    sorted[j] = value;
+  }
+  return sorted[n_readings_ / 2];
+}
+
+void IrRangeArray::run() {
+  // Take a reading of every sensor
+  for (uint8_t i=0; i < n_sensors_; i++) {
+    sensors_[i].readings[cur_reading_] = read_adc(i);
+  }
+  snapshot_.timestamp = micros();
+  cur_reading_++;
+  if (cur_reading_ >= IR_RANGE_MEDIAN_SIZE) {
+    cur_reading_ = 0;
+  }
+  if (n_readings_ < IR_RANGE_MEDIAN_SIZE) {
+    n_readings_++;
+  }
+
+  // Filter and convert them
+  for (uint8_t i=0; i < n_sensors_; i++) {
+    Sensor *s = &sensors_[i];
+    snapshot_.range[i] = convert(s->table, s->length, median(i));
+  }
+}
@@ -0,0 +1,118 @@
+/************************************************************************
+ * File : ir_range_array.h                                              *
+ *  Class to measure distances with Sharp IR range sensors.             *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __IR_RANGE_ARRAY_H
+#define __IR_RANGE_ARRAY_H
+
+#include <Arduino.h>
+#include <avr/pgmspace.h>
+#include <scheduler.h>
+#include "adc_scanner.h"
+
+// Maximum number of sensors
+#define IR_RANGE_MAX_SENSORS 6
+
+// Number of readings the median filter is computed on (odd)
+#define IR_RANGE_MEDIAN_SIZE 5
+
+// Point of a calibration table, as generated by tools/ir_calibration.cpp.
+// Tables are sorted by increasing ADC value (decreasing distance).
+struct IrCalibrationPoint {
+  uint16_t adc;      // ADC value (10 bits)
+  uint16_t distance; // distance in millimeters
+};
+
+// Ranges of all the sensors taken at the same time
+struct IrRangeSnapshot {
+  float range[IR_RANGE_MAX_SENSORS]; // in meters
+  unsigned long timestamp;           // micros() of the readings
+};
+
+class IrRangeArray : public ScheduledTask {
+ public:
+  // Constructor
+  //  Build a new sensor array
+  // Parameters:
+  //  - period: period between two readings of the sensors in microseconds
+  IrRangeArray(unsigned long period);
+
+  // Destructor
+  //  Does nothing
+  virtual ~IrRangeArray() {};
+
+  // void begin():
+  //  Start reading the sensors added with add_sensor().
+  void begin();
+
+  // char add_sensor(uint8_t pin, const IrCalibrationPoint *table,
+  //                 uint8_t length):
+  //  Add a sensor to the array.
+  // Parameters:
+  //  - pin: analog pin of the sensor (SHARP_0..SHARP_5). It is added to the
+  //         AdcScanner list, the sensor is read from it once it is started.
+  //  - table: calibration table of the sensor, stored in program memory
+  //           (PROGMEM)
+  //  - length: number of points in the table (at least 2)
+  // Return value:
+  //  -1 if no more sensors can be added or if the table is too short.
+  //  Index of the sensor otherwise.
+  char add_sensor(uint8_t pin, const IrCalibrationPoint *table, uint8_t length);
+
+  // float get_range(uint8_t sensor):
+  //  Return the last filtered distance measured by a sensor in meters.
+  //  Readings beyond the table are clamped to its first (resp. last) point.
+  float get_range(uint8_t sensor);
+
+  // float get_max_range(uint8_t sensor):
+  //  Return the farthest distance of the calibration table of a sensor in
+  //  meters. A sensor reading this distance does not see anything.
+  float get_max_range(uint8_t sensor);
+
+  // const IrRangeSnapshot *get_snapshot():
+  //  Return the last ranges of all the sensors.
+  const IrRangeSnapshot *get_snapshot();
+
+  // uint8_t get_number_of_sensors():
+  //  Return the number of sensors of the array.
+  uint8_t get_number_of_sensors();
+
+  // virtual void run():
+  //  Read all the sensors and publish a new snapshot.
+  virtual void run();
+
+  // static float convert(const IrCalibrationPoint *table, uint8_t length,
+  //                      int adc):
+  //  Interpolate the distance corresponding to an ADC value in a table
+  //  stored in program memory.
+  // Return value:
+  //  Distance in meters.
+  static float convert(const IrCalibrationPoint *table, uint8_t length, int adc);
+
+ protected:
+  // int read_adc(uint8_t sensor):
+  //  Return the ADC value of a sensor, from the scanner if it is running.
+  int read_adc(uint8_t sensor);
+
+  // int median(uint8_t sensor):
+  //  Return the median of the last readings of a sensor.
+  int median(uint8_t sensor);
+
+  struct Sensor {
+    uint8_t pin;
+    char channel;
+    const IrCalibrationPoint *table;
+    uint8_t length;
+    int readings[IR_RANGE_MEDIAN_SIZE];
+  };
+
+  Sensor sensors_[IR_RANGE_MAX_SENSORS];
+  uint8_t n_sensors_, n_readings_, cur_reading_;
+  IrRangeSnapshot snapshot_;
+};
+
+#endif // __IR_RANGE_ARRAY_H
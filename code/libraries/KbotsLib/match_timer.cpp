@@ -0,0 +1,186 @@
+/************************************************************************
+ * File : match_timer.cpp                                               *
+ *  Start cord latch and match clock stopping the robot at the end of   *
+ *  the match.                                                          *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * START_BTN (A0) has no pin change interrupt, so the start cord is     *
+ * sampled from the TIMER0 compare A interrupt (every 1024us), the      *
+ * overflow of TIMER0 still running millis(). analogWrite() cannot be   *
+ * used on pin 13 (OC0A) anymore.                                       *
+ * The end of the match is detected by this interrupt, which wakes the  *
+ * task up to engage the controlled stop and disables the motors itself *
+ * if they still run MATCH_STOP_TIMEOUT later, whatever the other tasks *
+ * are doing.                                                           *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "match_timer.h"
+
+// Half the sampling period in microseconds
+#define MATCH_HALF_SAMPLE_PERIOD 512
+
+volatile uint8_t *MatchTimer::cord_in_ = NULL;
+uint8_t MatchTimer::cord_mask_ = 0;
+uint8_t MatchTimer::cord_level_ = HIGH;
+uint8_t MatchTimer::count_ = 0;
+unsigned long MatchTimer::first_ = 0;
+volatile uint8_t MatchTimer::state_ = MatchTimer::waiting;
+volatile unsigned long MatchTimer::start_time_ = 0;
+unsigned long MatchTimer::duration_ = DEFAULT_MATCH_DURATION * 1000UL;
+MatchTimer *MatchTimer::timer_ = NULL;
+
+MatchTimer::MatchTimer(unsigned long period) :
+            ScheduledTask(period, 0) {
+  speed_profiler_ = NULL;
+  propulsion_ = NULL;
+  stop_engaged_ = false;
+  set_stop_decelerations(DEFAULT_MATCH_STOP_A_LIN, DEFAULT_MATCH_STOP_A_ROT);
+}
+
+void MatchTimer::begin(uint8_t pin, SpeedProfiler *speed_profiler,
+                       Propulsion *propulsion, unsigned long duration) {
+  speed_profiler_ = speed_profiler;
+  propulsion_ = propulsion;
+  stop_engaged_ = false;
+
+  pinMode(pin, INPUT_PULLUP);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  cord_in_ = portInputRegister(digitalPinToPort(pin));
+  cord_mask_ = digitalPinToBitMask(pin);
+  // The cord has to be seen inserted before the match can start, so that a
+  // missing cord does not start the match at power up
+  cord_level_ = HIGH;
+  count_ = 0;
+  state_ = waiting;
+  duration_ = duration * 1000UL;
+  timer_ = this;
+  // TIMER0 keeps its configuration, the compare interrupt fires once per
+  // overflow period
+  OCR0A = 0x80;
+  TIMSK0 |= _BV(OCIE0A);
+  SREG = oldSREG;
+
+  // start task now that the object has been initialized
+  start_task();
+}
+
+void MatchTimer::set_stop_decelerations(float a_lin, float a_rot) {
+  stop_a_lin_ = a_lin;
+  stop_a_rot_ = a_rot;
+}
+
+MatchTimer::match_state MatchTimer::get_state() {
+  return (match_state)state_;
+}
+
+unsigned long MatchTimer::get_start_time() {
+  uint8_t oldSREG = SREG;
+  cli();
+  unsigned long start = start_time_;
+  SREG = oldSREG;
+  return start;
+}
+
+unsigned long MatchTimer::get_elapsed_time() {
+  uint8_t state = state_;
+  if (state < running) {
+    return 0;
+  }
+  if (state > running) {
+    return duration_ / 1000UL;
+  }
+  unsigned long elapsed = micros() - get_start_time();
+  return min(elapsed, duration_) / 1000UL;
+}
+
+unsigned long MatchTimer::get_remaining_time() {
+  if (state_ < running) {
+    return duration_ / 1000UL;
+  }
+  return duration_ / 1000UL - get_elapsed_time();
+}
+
+void MatchTimer::run() {
+  if (state_ < stopping) {
+    return;
+  }
+
+  if (!stop_engaged_) {
+    // The deadline was detected by the interrupt, slow the robot down
+    stop_engaged_ = true;
+    stop_time_ = millis();
+    if (speed_profiler_ != NULL) {
+      speed_profiler_->controlled_stop(stop_a_lin_, stop_a_rot_);
+    }
+  }
+
+  if (state_ == stopping) {
+    // Disable the motors once stopped, or when the stop takes too long
+    if (speed_profiler_ == NULL
+        || speed_profiler_->is_following_profile() == SpeedProfiler::none
+        || millis() - stop_time_ >= MATCH_STOP_TIMEOUT) {
+      if (speed_profiler_ != NULL) {
+        speed_profiler_->stop_motion();
+      }
+      if (propulsion_ != NULL) {
+        propulsion_->set_motor_mode(Propulsion::disable);
+      }
+      state_ = finished;
+    }
+  } else if (speed_profiler_ != NULL
+             && speed_profiler_->is_following_profile() != SpeedProfiler::none) {
+    // No move is allowed after the end of the match
+    speed_profiler_->stop_motion();
+  }
+}
+
+void MatchTimer::sample() {
+  if (state_ == running) {
+    if (micros() - start_time_ >= duration_) {
+      state_ = stopping;
+      timer_->wake_task();
+    }
+    return;
+  }
+  if (state_ == stopping) {
+    // Hard cut-off, even if the tasks are stuck
+    if (micros() - start_time_ - duration_ >= MATCH_STOP_TIMEOUT * 1000UL) {
+      if (timer_->propulsion_ != NULL) {
+        timer_->propulsion_->halt();
+      }
+      state_ = finished;
+    }
+    return;
+  }
+  if (state_ > running || cord_in_ == NULL) {
+    return;
+  }
+
+  uint8_t level = (*cord_in_ & cord_mask_) ? HIGH : LOW;
+  if (level == cord_level_) {
+    count_ = 0;
+    return;
+  }
+  if (count_ == 0) {
+    // The transition happened between this sample and the previous one
+    first_ = micros() - MATCH_HALF_SAMPLE_PERIOD;
+  }
+  count_++;
+  if (count_ >= DEFAULT_MATCH_CORD_DEBOUNCE) {
+    cord_level_ = level;
+    count_ = 0;
+    if (level == LOW) {
+      state_ = armed;
+    } else if (state_ == armed) {
+      start_time_ = first_;
+      state_ = running;
+    }
+  }
+}
+
+ISR(TIMER0_COMPA_vect) {
+  MatchTimer::sample();
+}
@@ -0,0 +1,138 @@
+/************************************************************************
+ * File : match_timer.h                                                 *
+ *  Start cord latch and match clock stopping the robot at the end of   *
+ *  the match.                                                          *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * START_BTN (A0) has no pin change interrupt, so the start cord is     *
+ * sampled from the TIMER0 compare A interrupt (every 1024us), the      *
+ * overflow of TIMER0 still running millis(). analogWrite() cannot be   *
+ * used on pin 13 (OC0A) anymore.                                       *
+ * The end of the match is detected by this interrupt, which wakes the  *
+ * task up to engage the controlled stop and disables the motors itself *
+ * if they still run MATCH_STOP_TIMEOUT later, whatever the other tasks *
+ * are doing.                                                           *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __MATCH_TIMER_H
+#define __MATCH_TIMER_H
+
+#include <Arduino.h>
+#include <scheduler.h>
+#include "propulsion.h"
+#include "speed_profiler.h"
+
+// Default duration of the match in milliseconds
+#define DEFAULT_MATCH_DURATION 90000UL
+
+// Default number of samples (about 1ms each) a new level of the start cord
+// has to be stable to be accepted
+#define DEFAULT_MATCH_CORD_DEBOUNCE 10
+
+// Default decelerations of the final stop in m/s^2 and rad/s^2
+#define DEFAULT_MATCH_STOP_A_LIN 1.
+#define DEFAULT_MATCH_STOP_A_ROT (2.*M_PI)
+
+// Maximum time in milliseconds given to the controlled stop before the
+// motors are disabled whatever the robot is doing. This cut-off is done by
+// the interrupt, so it does not depend on the other tasks.
+#define MATCH_STOP_TIMEOUT 1000UL
+
+class MatchTimer : public ScheduledTask {
+ public:
+  enum match_state {
+    waiting = 0,  // start cord not inserted yet
+    armed,        // start cord inserted, waiting for it to be pulled
+    running,      // match in progress
+    stopping,     // match over, the robot is slowing down
+    finished      // match over, the motors are disabled
+  };
+
+  // Constructor
+  //  Build a new match timer
+  // Parameters:
+  //  - period: period of the task in microseconds. The task is woken up
+  //            by the interrupt at the end of the match, so the controlled
+  //            stop is engaged after at most the longest run() of the other
+  //            tasks. Whatever they do, the interrupt disables the motors
+  //            MATCH_STOP_TIMEOUT (plus about 1ms) after the end of the
+  //            match.
+  MatchTimer(unsigned long period);
+
+  // Destructor
+  //  Does nothing
+  virtual ~MatchTimer() {};
+
+  // void begin(uint8_t pin, SpeedProfiler *speed_profiler,
+  //            Propulsion *propulsion, unsigned long duration):
+  //  Configure the start cord pin (input with pull-up, LOW while the cord
+  //  is inserted) and start watching it. The cord has to be inserted to arm
+  //  the timer, the match starts when it is pulled.
+  // Parameters:
+  //  - pin: pin of the start cord (START_BTN)
+  //  - speed_profiler: pointer to the SpeedProfiler used to stop the robot
+  //                    (can be NULL, the motors are then disabled directly)
+  //  - propulsion: pointer to the Propulsion object whose motors are
+  //                disabled once the robot is stopped
+  //  - duration: duration of the match in milliseconds
+  void begin(uint8_t pin, SpeedProfiler *speed_profiler,
+             Propulsion *propulsion,
+             unsigned long duration = DEFAULT_MATCH_DURATION);
+
+  // void set_stop_decelerations(float a_lin, float a_rot):
+  //  Change the decelerations of the stop at the end of the match.
+  // Parameters:
+  //  - a_lin: linear deceleration in m/s^2
+  //  - a_rot: rotational deceleration in rad/s^2
+  void set_stop_decelerations(float a_lin, float a_rot);
+
+  // static match_state get_state():
+  //  Return the state of the match.
+  static match_state get_state();
+
+  // static unsigned long get_start_time():
+  //  Return the micros() timestamp of the start cord being pulled. Only
+  //  meaningful once the match has started.
+  static unsigned long get_start_time();
+
+  // static unsigned long get_elapsed_time():
+  // static unsigned long get_remaining_time():
+  //  Return the time elapsed since the start of the match (resp. left
+  //  before its end) in milliseconds. Both are computed from the start
+  //  timestamp and do not accumulate any error.
+  static unsigned long get_elapsed_time();
+  static unsigned long get_remaining_time();
+
+  // virtual void run():
+  //  Stop the robot once the match is over.
+  virtual void run();
+
+  // static void sample():
+  //  For internal use by the interrupt vector: samples the start cord,
+  //  checks the end of the match and cuts the motors when the stop takes
+  //  too long.
+  static void sample();
+
+ protected:
+  SpeedProfiler *speed_profiler_;
+  Propulsion *propulsion_;
+  float stop_a_lin_, stop_a_rot_;
+  boolean stop_engaged_;
+  unsigned long stop_time_;
+
+  // Start cord, sampled from the interrupt
+  static volatile uint8_t *cord_in_;
+  static uint8_t cord_mask_;
+  static uint8_t cord_level_, count_;
+  static unsigned long first_;
+
+  static volatile uint8_t state_;
+  static volatile unsigned long start_time_;
+  static unsigned long duration_;
+
+  // Task woken up at the end of the match, and whose motors are cut
+  static MatchTimer *timer_;
+};
+
+#endif // __MATCH_TIMER_H
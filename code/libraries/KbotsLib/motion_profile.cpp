@@ -0,0 +1,204 @@
+/************************************************************************
+ * File : motion_profile.cpp                                            *
+ *  Class to plan and evaluate one dimensional motion profiles.         *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "motion_profile.h"
+
+// Number of iterations used to find the peak speed of short profiles
+#define PEAK_SPEED_ITERATIONS 20
+
+MotionProfile::MotionProfile() {
+  build(0., 0., 0., 0., 0., 0.);
+  sign_ = 1.;
+}
+
+float MotionProfile::phase_times(float dv, float amax, float jmax,
+                                 float *tj, float *ta, float *ap) {
+  if (dv <= 0. || amax <= 0.) {
+    *tj = 0.;
+    *ta = 0.;
+    *ap = 0.;
+  } else if (jmax <= 0.) {
+    // Trapezoidal profile: acceleration steps to amax
+    *tj = 0.;
+    *ta = dv / amax;
+    *ap = amax;
+  } else if (dv * jmax >= amax * amax) {
+    // amax is reached
+    *tj = amax / jmax;
+    *ta = dv / amax - *tj;
+    *ap = amax;
+  } else {
+    // Triangular acceleration
+    *tj = sqrt(dv / jmax);
+    *ta = 0.;
+    *ap = jmax * *tj;
+  }
+
+  return 2. * *tj + *ta;
+}
+
+float MotionProfile::phase_distance(float va, float vb,
+                                    float amax, float jmax) {
+  float tj, ta, ap;
+  return (va + vb) / 2. * phase_times(fabs(vb - va), amax, jmax, &tj, &ta, &ap);
+}
+
+void MotionProfile::add_segment(float duration, float a, float j) {
+  if (duration <= 0.) {
+    return;
+  }
+  uint8_t k = n_segments_;
+  a_[k] = a;
+  j_[k] = j;
+  t_[k+1] = t_[k] + duration;
+  v_[k+1] = v_[k] + duration * (a + j * duration / 2.);
+  s_[k+1] = s_[k] + duration * (v_[k] + duration * (a / 2. + j * duration / 6.));
+  a_[k+1] = a + j * duration;
+  n_segments_++;
+}
+
+void MotionProfile::build(float v0, float vp, float v1, float cruise,
+                          float amax, float jmax) {
+  float tj, ta, ap, dir;
+
+  n_segments_ = 0;
+  cur_segment_ = 0;
+  t_[0] = 0.;
+  s_[0] = 0.;
+  v_[0] = v0;
+  a_[0] = 0.;
+
+  // Speed change from v0 to vp
+  dir = vp >= v0 ? 1. : -1.;
+  phase_times(fabs(vp - v0), amax, jmax, &tj, &ta, &ap);
+  add_segment(tj, 0., dir * jmax);
+  add_segment(ta, dir * ap, 0.);
+  add_segment(tj, dir * ap, -dir * jmax);
+
+  add_segment(cruise, 0., 0.);
+
+  // Speed change from vp to v1
+  dir = v1 >= vp ? 1. : -1.;
+  phase_times(fabs(v1 - vp), amax, jmax, &tj, &ta, &ap);
+  add_segment(tj, 0., dir * jmax);
+  add_segment(ta, dir * ap, 0.);
+  add_segment(tj, dir * ap, -dir * jmax);
+}
+
+void MotionProfile::plan(float d, float vmax, float amax, float jmax,
+                         float v0, float v1) {
+  float dist = fabs(d);
+
+  sign_ = d >= 0. ? 1. : -1.;
+  if (vmax <= 0. || amax <= 0. || (dist <= 0. && v0 <= 0.)) {
+    build(0., 0., 0., 0., 0., 0.);
+    return;
+  }
+  if (v1 > vmax) {
+    v1 = vmax;
+  }
+
+  // Check that the final speed can be reached at all
+  if (phase_distance(v0, v1, amax, jmax) > dist) {
+    if (v1 > v0) {
+      v1 = reachable_speed(dist, v0, amax, jmax);
+    }
+    build(v0, fmax(v0, v1), v1, 0., amax, jmax);
+    return;
+  }
+
+  float lo = fmax(v0, v1), hi = fmax(v0, vmax);
+  float d_peak = phase_distance(v0, hi, amax, jmax)
+                 + phase_distance(hi, v1, amax, jmax);
+  if (d_peak <= dist) {
+    // Normal profile
+    build(v0, hi, v1, (dist - d_peak) / hi, amax, jmax);
+  } else {
+    // Degenerated profile: vmax is not reached
+    for (uint8_t i=0; i < PEAK_SPEED_ITERATIONS; i++) {
+      float vp = (lo + hi) / 2.;
+      if (phase_distance(v0, vp, amax, jmax)
+          + phase_distance(vp, v1, amax, jmax) > dist) {
+        hi = vp;
+      } else {
+        lo = vp;
+      }
+    }
+    d_peak = phase_distance(v0, lo, amax, jmax)
+             + phase_distance(lo, v1, amax, jmax);
+    build(v0, lo, v1, lo > 0. ? (dist - d_peak) / lo : 0., amax, jmax);
+  }
+}
+
+void MotionProfile::plan_stop(float v0, float amax, float jmax) {
+  sign_ = v0 >= 0. ? 1. : -1.;
+  build(fabs(v0), fabs(v0), 0., 0., amax, jmax);
+}
+
+float MotionProfile::get_duration() {
+  return t_[n_segments_];
+}
+
+float MotionProfile::get_distance() {
+  return sign_ * s_[n_segments_];
+}
+
+float MotionProfile::get_final_speed() {
+  return sign_ * v_[n_segments_];
+}
+
+float MotionProfile::reachable_speed(float d, float v, float amax, float jmax) {
+  if (d <= 0. || amax <= 0.) {
+    return v;
+  }
+  // Exact for a trapezoidal profile, upper bound otherwise
+  float hi = sqrt(v * v + 2. * amax * d);
+  if (jmax <= 0.) {
+    return hi;
+  }
+  float lo = v;
+  for (uint8_t i=0; i < PEAK_SPEED_ITERATIONS; i++) {
+    float vp = (lo + hi) / 2.;
+    if (phase_distance(v, vp, amax, jmax) > d) {
+      hi = vp;
+    } else {
+      lo = vp;
+    }
+  }
+  return lo;
+}
+
+uint8_t MotionProfile::find_segment(float t) {
+  if (cur_segment_ > n_segments_ || t < t_[cur_segment_]) {
+    cur_segment_ = 0;
+  }
+  while (cur_segment_ < n_segments_ && t >= t_[cur_segment_+1]) {
+    cur_segment_++;
+  }
+  return cur_segment_;
+}
+
+float MotionProfile::speed(float t) {
+  uint8_t k = find_segment(t);
+  if (k >= n_segments_) {
+    return sign_ * v_[n_segments_];
+  }
+  float dt = t - t_[k];
+  if (dt < 0.) dt = 0.;
+  return sign_ * (v_[k] + dt * (a_[k] + j_[k] * dt / 2.));
+}
+
+float MotionProfile::position(float t) {
+  uint8_t k = find_segment(t);
+  if (k >= n_segments_) {
+    return sign_ * s_[n_segments_];
+  }
+  float dt = t - t_[k];
+  if (dt < 0.) dt = 0.;
+  return sign_ * (s_[k] + dt * (v_[k] + dt * (a_[k] / 2. + j_[k] * dt / 6.)));
+}
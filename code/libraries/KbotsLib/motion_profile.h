@@ -0,0 +1,129 @@
+/************************************************************************
+ * File : motion_profile.h                                              *
+ *  Class to plan and evaluate one dimensional motion profiles.         *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __MOTION_PROFILE_H
+#define __MOTION_PROFILE_H
+
+#include <stdint.h>
+#include <math.h>
+
+// A profile is made of at most 7 segments: jerk up, constant acceleration,
+// jerk down, cruise, and the same three segments for the deceleration.
+#define MOTION_PROFILE_MAX_SEGMENTS 7
+
+class MotionProfile {
+ public:
+  // Constructor:
+  //  Builds an empty profile (zero duration)
+  MotionProfile();
+
+  // void plan(float d, float vmax, float amax, float jmax,
+  //           float v0, float v1):
+  //  Plans a profile. All the computations are done here so that evaluating
+  //  the profile is cheap.
+  // Parameters:
+  //  - d: distance to travel. Negative values move backwards.
+  //  - vmax: maximum velocity to achieve during the movement (positive).
+  //  - amax: maximum acceleration allowed during the movement (positive).
+  //  - jmax: maximum jerk allowed during the movement (positive). If this
+  //          value is zero, the profile is trapezoidal (infinite jerk).
+  //  - v0: speed at the start of the profile, counted positively in the
+  //        direction of d (defaults to 0).
+  //  - v1: speed wanted at the end of the profile, counted positively in the
+  //        direction of d (defaults to 0). It is lowered if it cannot be
+  //        reached within d. If the profile cannot slow down to v1 within d,
+  //        it overshoots d (see reachable_speed to avoid it).
+  void plan(float d, float vmax, float amax, float jmax,
+            float v0 = 0., float v1 = 0.);
+
+  // void plan_stop(float v0, float amax, float jmax):
+  //  Plans a profile slowing down from a given speed to rest in minimum time.
+  // Parameters:
+  //  - v0: initial speed (signed)
+  //  - amax, jmax: see plan()
+  void plan_stop(float v0, float amax, float jmax);
+
+  // float get_duration():
+  //  Return the duration of the profile in seconds
+  float get_duration();
+
+  // float get_distance():
+  //  Return the (signed) distance traveled during the profile
+  float get_distance();
+
+  // float get_final_speed():
+  //  Return the (signed) speed at the end of the profile
+  float get_final_speed();
+
+  // static float reachable_speed(float d, float v, float amax, float jmax):
+  //  Compute the highest speed which can be reached from v within a given
+  //  distance. This is also the highest speed from which v can be reached.
+  // Parameters:
+  //  - d: available distance (positive)
+  //  - v: speed at the other end of the distance (positive)
+  //  - amax, jmax: see plan()
+  static float reachable_speed(float d, float v, float amax, float jmax);
+
+  // float speed(float t):
+  // float position(float t):
+  //  Evaluate the profile at a given time.
+  // Parameters:
+  //  - t: time elapsed since the start of the profile in seconds. Calls are
+  //       cheaper when t increases from one call to the next one.
+  // Return value:
+  //  Speed (resp. distance traveled) at time t. Values after the end of the
+  //  profile are those of the last point.
+  float speed(float t);
+  float position(float t);
+
+ protected:
+  // static void phase_times(float dv, float amax, float jmax,
+  //                         float *tj, float *ta, float *ap):
+  //  Compute the shape of a phase changing the speed of dv >= 0.
+  // Parameters:
+  //  - tj: pointer to the variable in which to store the duration of each
+  //        jerk segment
+  //  - ta: pointer to the variable in which to store the duration of the
+  //        constant acceleration segment
+  //  - ap: pointer to the variable in which to store the peak acceleration
+  // Return value:
+  //  Total duration of the phase
+  static float phase_times(float dv, float amax, float jmax,
+                           float *tj, float *ta, float *ap);
+
+  // static float phase_distance(float va, float vb, float amax, float jmax):
+  //  Compute the distance traveled while changing the speed from va to vb.
+  //  The acceleration of a phase is symmetric, so the average speed is
+  //  (va+vb)/2.
+  static float phase_distance(float va, float vb, float amax, float jmax);
+
+  // void build(float v0, float vp, float v1, float cruise,
+  //            float amax, float jmax):
+  //  Build the segments of a profile going from v0 to vp, cruising at vp
+  //  during the given time, then going from vp to v1.
+  void build(float v0, float vp, float v1, float cruise,
+             float amax, float jmax);
+
+  // void add_segment(float duration, float a, float j):
+  //  Append a segment with the given initial acceleration and jerk.
+  void add_segment(float duration, float a, float j);
+
+  // uint8_t find_segment(float t):
+  //  Return the index of the segment containing time t.
+  uint8_t find_segment(float t);
+
+  // Start time, position, speed and acceleration of each segment, and the
+  // final point of the profile
+  float t_[MOTION_PROFILE_MAX_SEGMENTS+1], s_[MOTION_PROFILE_MAX_SEGMENTS+1];
+  float v_[MOTION_PROFILE_MAX_SEGMENTS+1], a_[MOTION_PROFILE_MAX_SEGMENTS+1];
+  float j_[MOTION_PROFILE_MAX_SEGMENTS];
+  float sign_;
+  uint8_t n_segments_, cur_segment_;
+};
+
+#endif // __MOTION_PROFILE_H
@@ -11,127 +11,75 @@
 #define COS_FACT 0.6666666666666667 // 1/(1-cos(2*pi/3))
 #define SIN_FACT 0.5773502691896257 // 1/(2*sin(2*pi/3))
 
-volatile uint8_t Odometry::left_A_;
-volatile uint8_t Odometry::left_B_;
-volatile uint8_t Odometry::right_A_;
-volatile uint8_t Odometry::right_B_;
-volatile uint8_t Odometry::front_A_;
-volatile uint8_t Odometry::front_B_;
-volatile unsigned int Odometry::left_enc_;
-volatile unsigned int Odometry::right_enc_;
-volatile unsigned int Odometry::front_enc_;
+volatile uint8_t Odometry::enc_A_[ODOMETRY_MAX_WHEELS];
+volatile uint8_t Odometry::enc_B_[ODOMETRY_MAX_WHEELS];
+volatile unsigned int Odometry::enc_[ODOMETRY_MAX_WHEELS];
 volatile boolean Odometry::enable_encoders_;
 
-void interrupt_left_enc_A() {
+// Quadrature decoding: on an edge of channel A (resp. B), the counter is
+// incremented if both channels are equal (resp. different). Wheels on the
+// right side of the robot count the other way.
+static inline void decode_edge(uint8_t wheel, boolean channel_A, boolean inverted) {
   if (Odometry::enable_encoders_) {
-    if (digitalRead(Odometry::left_A_)) {
-      if (digitalRead(Odometry::left_B_)) {
-        Odometry::left_enc_++;
-      } else {
-        Odometry::left_enc_--;
-      }
+    boolean same = (digitalRead(Odometry::enc_A_[wheel])
+                    == digitalRead(Odometry::enc_B_[wheel]));
+    if ((same == channel_A) != inverted) {
+      Odometry::enc_[wheel]++;
     } else {
-      if (digitalRead(Odometry::left_B_)) {
-        Odometry::left_enc_--;
-      } else {
-        Odometry::left_enc_++;
-      }
+      Odometry::enc_[wheel]--;
     }
   }
 }
 
+void interrupt_left_enc_A() {
+  decode_edge(0, true, false);
+}
+
 void interrupt_left_enc_B() {
-  if (Odometry::enable_encoders_) {
-    if (digitalRead(Odometry::left_B_)) {
-      if (digitalRead(Odometry::left_A_)) {
-        Odometry::left_enc_--;
-      } else {
-        Odometry::left_enc_++;
-      }
-    } else {
-      if (digitalRead(Odometry::left_A_)) {
-        Odometry::left_enc_++;
-      } else {
-        Odometry::left_enc_--;
-      }
-    }
-  }
+  decode_edge(0, false, false);
 }
 
 void interrupt_right_enc_A() {
-  if (Odometry::enable_encoders_) {
-    if (digitalRead(Odometry::right_A_)) {
-      if (digitalRead(Odometry::right_B_)) {
-        Odometry::right_enc_--;
-      } else {
-        Odometry::right_enc_++;
-      }
-    } else {
-      if (digitalRead(Odometry::right_B_)) {
-        Odometry::right_enc_++;
-      } else {
-        Odometry::right_enc_--;
-      }
-    }
-  }
+  decode_edge(1, true, true);
 }
 
 void interrupt_right_enc_B() {
-  if (Odometry::enable_encoders_) {
-    if (digitalRead(Odometry::right_B_)) {
-      if (digitalRead(Odometry::right_A_)) {
-        Odometry::right_enc_++;
-      } else {
-        Odometry::right_enc_--;
-      }
-    } else {
-      if (digitalRead(Odometry::right_A_)) {
-        Odometry::right_enc_--;
-      } else {
-        Odometry::right_enc_++;
-      }
-    }
-  }
+  decode_edge(1, false, true);
 }
 
 void interrupt_front_enc_A() {
-  if (Odometry::enable_encoders_) {
-    if (digitalRead(Odometry::front_A_)) {
-      if (digitalRead(Odometry::front_B_)) {
-        Odometry::front_enc_++;
-      } else {
-        Odometry::front_enc_--;
-      }
-    } else {
-      if (digitalRead(Odometry::front_B_)) {
-        Odometry::front_enc_--;
-      } else {
-        Odometry::front_enc_++;
-      }
-    }
-  }
+  decode_edge(2, true, false);
 }
 
 void interrupt_front_enc_B() {
-  if (Odometry::enable_encoders_) {
-    if (digitalRead(Odometry::front_B_)) {
-      if (digitalRead(Odometry::front_A_)) {
-        Odometry::front_enc_--;
-      } else {
-        Odometry::front_enc_++;
-      }
-    } else {
-      if (digitalRead(Odometry::front_A_)) {
-        Odometry::front_enc_++;
-      } else {
-        Odometry::front_enc_--;
-      }
-    }
-  }
+  decode_edge(2, false, false);
+}
+
+void interrupt_rear_enc_A() {
+  decode_edge(3, true, true);
+}
+
+void interrupt_rear_enc_B() {
+  decode_edge(3, false, true);
 }
 
 Odometry::Odometry(unsigned long period) :
   ScheduledTask(period, 0) {
+  residual_ = 0.;
+}
+
+void Odometry::init_wheel(uint8_t wheel, float gain, float radius,
+                          uint8_t cod_A, uint8_t cod_B) {
+  gain_[wheel] = gain;
+  radius_[wheel] = radius;
+  angle_[wheel] = 0.;
+  enc_[wheel] = 0;
+  last_enc_[wheel] = 0;
+
+  enc_A_[wheel] = cod_A;
+  enc_B_[wheel] = cod_B;
+  pinMode(cod_A, INPUT);
+  pinMode(cod_B, INPUT);
 }
 
 void Odometry::begin(float left_gain, float left_radius,
@@ -143,34 +91,22 @@ void Odometry::begin(float left_gain, float left_radius,
                      uint8_t right_cod_B, uint8_t right_cod_interrupt_B) {
 
   type_ = differential;
-
-  left_gain_ = left_gain;
-  left_radius_ = left_radius;
-  right_gain_ = right_gain;
-  right_radius_ = right_radius;
+  n_wheels_ = 2;
   shaft_ = shaft_width;
 
-  left_enc_ = 0;
-  last_left_ = 0;
-  right_enc_ = 0;
-  last_right_ = 0;
+  init_wheel(0, left_gain, left_radius, left_cod_A, left_cod_B);
+  init_wheel(1, right_gain, right_radius, right_cod_A, right_cod_B);
 
-  enable_encoders_ = true;
+  // Displacement according to the robot's reference frame
+  kinematics_[0][0] = 0.5;
+  kinematics_[0][1] = 0.5;
+  kinematics_[1][0] = 0.;
+  kinematics_[1][1] = 0.;
+  kinematics_[2][0] = -1. / shaft_;
+  kinematics_[2][1] = 1. / shaft_;
 
+  enable_encoders_ = true;
   reset(0., 0., 0.);
-  left_angle_ = 0.;
-  right_angle_ = 0.;
-  front_angle_ = 0.;
-
-  left_A_ = left_cod_A;
-  left_B_ = left_cod_B;
-  right_A_ = right_cod_A;
-  right_B_ = right_cod_B;
-
-  pinMode(left_A_, INPUT);
-  pinMode(left_B_, INPUT);
-  pinMode(right_A_, INPUT);
-  pinMode(right_B_, INPUT);
 
   attachInterrupt(left_cod_interrupt_A,interrupt_left_enc_A,CHANGE);
   attachInterrupt(left_cod_interrupt_B,interrupt_left_enc_B,CHANGE);
@@ -193,42 +129,26 @@ void Odometry::begin(float left_gain, float left_radius,
                      uint8_t front_cod_B, uint8_t front_cod_interrupt_B) {
 
   type_ = omnidirectional;
-
-  left_gain_ = left_gain;
-  left_radius_ = left_radius;
-  right_gain_ = right_gain;
-  right_radius_ = right_radius;
-  front_gain_ = front_gain;
-  front_radius_ = front_radius;
+  n_wheels_ = 3;
   shaft_ = robot_radius;
 
-  left_enc_ = 0;
-  last_left_ = 0;
-  right_enc_ = 0;
-  last_right_ = 0;
-  front_enc_ = 0;
-  last_front_ = 0;
+  init_wheel(0, left_gain, left_radius, left_cod_A, left_cod_B);
+  init_wheel(1, right_gain, right_radius, right_cod_A, right_cod_B);
+  init_wheel(2, front_gain, front_radius, front_cod_A, front_cod_B);
+
+  // Displacement according to the robot's reference frame
+  kinematics_[0][0] = COS_FACT / 2.;
+  kinematics_[0][1] = COS_FACT / 2.;
+  kinematics_[0][2] = -COS_FACT;
+  kinematics_[1][0] = -SIN_FACT;
+  kinematics_[1][1] = SIN_FACT;
+  kinematics_[1][2] = 0.;
+  for (uint8_t i=0; i < 3; i++) {
+    kinematics_[2][i] = COS_FACT / (2. * shaft_);
+  }
 
   enable_encoders_ = true;
-
   reset(0., 0., 0.);
-  left_angle_ = 0.;
-  right_angle_ = 0.;
-  front_angle_ = 0.;
-
-  left_A_ = left_cod_A;
-  left_B_ = left_cod_B;
-  right_A_ = right_cod_A;
-  right_B_ = right_cod_B;
-  front_A_ = front_cod_A;
-  front_B_ = front_cod_B;
-
-  pinMode(left_A_, INPUT);
-  pinMode(left_B_, INPUT);
-  pinMode(right_A_, INPUT);
-  pinMode(right_B_, INPUT);
-  pinMode(front_A_, INPUT);
-  pinMode(front_B_, INPUT);
 
   attachInterrupt(left_cod_interrupt_A,interrupt_left_enc_A,CHANGE);
   attachInterrupt(left_cod_interrupt_B,interrupt_left_enc_B,CHANGE);
@@ -241,65 +161,106 @@ void Odometry::begin(float left_gain, float left_radius,
   start_task();
 }
 
+void Odometry::begin(float front_left_gain, float front_right_gain,
+                     float rear_left_gain, float rear_right_gain,
+                     float wheel_radius, float half_length, float half_width,
+                     uint8_t front_left_cod_A, uint8_t front_left_cod_interrupt_A,
+                     uint8_t front_left_cod_B, uint8_t front_left_cod_interrupt_B,
+                     uint8_t front_right_cod_A, uint8_t front_right_cod_interrupt_A,
+                     uint8_t front_right_cod_B, uint8_t front_right_cod_interrupt_B,
+                     uint8_t rear_left_cod_A, uint8_t rear_left_cod_interrupt_A,
+                     uint8_t rear_left_cod_B, uint8_t rear_left_cod_interrupt_B,
+                     uint8_t rear_right_cod_A, uint8_t rear_right_cod_B) {
+
+  type_ = mecanum;
+  n_wheels_ = 4;
+  shaft_ = half_length + half_width;
+
+  init_wheel(0, front_left_gain, wheel_radius, front_left_cod_A, front_left_cod_B);
+  init_wheel(1, front_right_gain, wheel_radius, front_right_cod_A, front_right_cod_B);
+  init_wheel(2, rear_left_gain, wheel_radius, rear_left_cod_A, rear_left_cod_B);
+  init_wheel(3, rear_right_gain, wheel_radius, rear_right_cod_A, rear_right_cod_B);
+
+  // Least squares solution (pseudo-inverse) of the inverse kinematics:
+  //   [fl, fr, rl, rr] = [[1, -1, -k], [1, 1, k], [1, 1, -k], [1, -1, k]] * [x, y, theta]
+  // with k = half_length + half_width. The columns being orthogonal, the
+  // pseudo-inverse is simply the scaled transpose.
+  const float signs[3][4] = {{1., 1., 1., 1.},
+                             {-1., 1., 1., -1.},
+                             {-1., 1., -1., 1.}};
+  for (uint8_t i=0; i < 4; i++) {
+    kinematics_[0][i] = signs[0][i] / 4.;
+    kinematics_[1][i] = signs[1][i] / 4.;
+    kinematics_[2][i] = signs[2][i] / (4. * shaft_);
+  }
+
+  enable_encoders_ = true;
+  reset(0., 0., 0.);
+
+  attachInterrupt(front_left_cod_interrupt_A,interrupt_left_enc_A,CHANGE);
+  attachInterrupt(front_left_cod_interrupt_B,interrupt_left_enc_B,CHANGE);
+  attachInterrupt(front_right_cod_interrupt_A,interrupt_right_enc_A,CHANGE);
+  attachInterrupt(front_right_cod_interrupt_B,interrupt_right_enc_B,CHANGE);
+  attachInterrupt(rear_left_cod_interrupt_A,interrupt_front_enc_A,CHANGE);
+  attachInterrupt(rear_left_cod_interrupt_B,interrupt_front_enc_B,CHANGE);
+  PinChange::attach(rear_right_cod_A, interrupt_rear_enc_A);
+  PinChange::attach(rear_right_cod_B, interrupt_rear_enc_B);
+
+  // start task now that the object has been initialized
+  start_task();
+}
+
 void Odometry::run(void) {
+  float disp[ODOMETRY_MAX_WHEELS];
+  unsigned long cur_time = micros();
 
-  if (type_ == differential) {
-    unsigned int left_enc = left_enc_;
-    unsigned int right_enc = right_enc_;
-    unsigned int left_delta = left_enc - last_left_;
-    unsigned int right_delta = right_enc - last_right_;
-    float delta_l = left_gain_ * (left_delta >= 32768 ? ((long)left_delta) - 65536 : left_delta);
-    float delta_r = right_gain_ * (right_delta >= 32768 ? ((long)right_delta) - 65536 : right_delta);
+  for (uint8_t i=0; i < n_wheels_; i++) {
+    unsigned int enc = enc_[i];
+    unsigned int delta = enc - last_enc_[i];
+    float angle = gain_[i] * (delta >= 32768 ? ((long)delta) - 65536 : delta);
 
     // New state computation
-    left_angle_ += delta_l;
-    right_angle_ += delta_r;
-    x_ += (right_radius_ * delta_r + left_radius_ * delta_l) / 2.0 * cos(theta_);
-    y_ += (right_radius_ * delta_r + left_radius_ * delta_l) / 2.0 * sin(theta_);
-    theta_ += (right_radius_ * delta_r - left_radius_ * delta_l) / shaft_;
-
-    last_left_ = left_enc;
-    last_right_ = right_enc;
-  } else {
-    unsigned int left_enc = left_enc_;
-    unsigned int right_enc = right_enc_;
-    unsigned int front_enc = front_enc_;
-    unsigned int left_delta = left_enc - last_left_;
-    unsigned int right_delta = right_enc - last_right_;
-    unsigned int front_delta = front_enc - last_front_;
-    float delta_l = left_gain_ * (left_delta >= 32768 ? ((long)left_delta) - 65536 : left_delta);
-    float delta_r = right_gain_ * (right_delta >= 32768 ? ((long)right_delta) - 65536 : right_delta);
-    float delta_f = front_gain_ * (front_delta >= 32768 ? ((long)front_delta) - 65536 : front_delta);
+    angle_[i] += angle;
+    disp[i] = radius_[i] * angle;
 
-    // New state computation
-    left_angle_ += delta_l;
-    right_angle_ += delta_r;
-    front_angle_ += delta_f;
-
-    // Displacement according to the robot's reference frame
-    float lx = (- front_radius_ * delta_f
-                + left_radius_ * delta_l / 2.
-                + right_radius_ * delta_r /2.) * COS_FACT;
-    float ly = (- left_radius_ * delta_l + right_radius_ * delta_r) * SIN_FACT;
-
-    // Compute absolute displacement
-    x_ += lx*cos(theta_) - ly*sin(theta_);
-    y_ += lx*sin(theta_) + ly*cos(theta_);
-    theta_ += (front_radius_*delta_f
-               + left_radius_ * delta_l
-               + right_radius_ * delta_r) / (2.*shaft_) * COS_FACT;
-
-    last_left_ = left_enc;
-    last_right_ = right_enc;
-    last_front_ = front_enc;
+    last_enc_[i] = enc;
   }
 
+  // Displacement according to the robot's reference frame
+  float local[3] = {0., 0., 0.};
+  for (uint8_t j=0; j < 3; j++) {
+    for (uint8_t i=0; i < n_wheels_; i++) {
+      local[j] += kinematics_[j][i] * disp[i];
+    }
+  }
+
+  // Part of the displacement not explained by the least squares solution
+  if (type_ == mecanum) {
+    residual_ = fabs(disp[0] + disp[1] - disp[2] - disp[3]) / 4.;
+  }
+
+  // Compute absolute displacement
+  x_ += local[0]*cos(theta_) - local[1]*sin(theta_);
+  y_ += local[0]*sin(theta_) + local[1]*cos(theta_);
+  theta_ += local[2];
+
   // Normalization of theta
   if (theta_ > M_PI) {
     theta_ -= 2.*M_PI;
   } else if (theta_ < -M_PI) {
     theta_ += 2.*M_PI;
   }
+
+  // Record the new position
+  history_head_ = (history_head_ + 1) % ODOMETRY_HISTORY_SIZE;
+  Pose *p = &history_[history_head_];
+  p->time = cur_time;
+  p->x = x_;
+  p->y = y_;
+  p->theta = theta_;
+  if (history_length_ < ODOMETRY_HISTORY_SIZE) {
+    history_length_++;
+  }
 }
 
 float Odometry::get_x() {
@@ -312,13 +273,20 @@ float Odometry::get_theta() {
   return theta_;
 }
 float Odometry::get_left_angle() {
-  return left_angle_;
+  return angle_[0];
 }
 float Odometry::get_right_angle() {
-  return right_angle_;
+  return angle_[1];
 }
 float Odometry::get_front_angle() {
-  return front_angle_;
+  return angle_[2];
+}
+float Odometry::get_wheel_angle(uint8_t wheel) {
+  return angle_[wheel];
+}
+
+float Odometry::get_kinematic_residual() {
+  return residual_;
 }
 
 void Odometry::get_position(float *x, float *y, float *theta) {
@@ -328,14 +296,74 @@ void Odometry::get_position(float *x, float *y, float *theta) {
 }
 
 void Odometry::get_angles(float *left, float *right) {
-  *left = left_angle_;
-  *right = right_angle_;
+  *left = angle_[0];
+  *right = angle_[1];
+}
+
+void Odometry::get_angles(float *left, float *right, float *front) {
+  *left = angle_[0];
+  *right = angle_[1];
+  *front = angle_[2];
+}
+
+char Odometry::get_position_at(unsigned long time,
+                               float *x, float *y, float *theta) {
+  if (history_length_ == 0) {
+    return -1;
+  }
+
+  // Find the most recent update done before the given time
+  uint8_t k = history_head_, n = 0;
+  while ((long)(time - history_[k].time) < 0) {
+    n++;
+    if (n >= history_length_) {
+      return -1;
+    }
+    k = (k + ODOMETRY_HISTORY_SIZE - 1) % ODOMETRY_HISTORY_SIZE;
+  }
+  Pose *p0 = &history_[k], *p1;
+  if (n > 0) {
+    // Interpolate with the next update
+    p1 = &history_[(k + 1) % ODOMETRY_HISTORY_SIZE];
+  } else if (history_length_ > 1) {
+    // Extrapolate from the previous update
+    p1 = p0;
+    p0 = &history_[(k + ODOMETRY_HISTORY_SIZE - 1) % ODOMETRY_HISTORY_SIZE];
+  } else {
+    *x = p0->x;
+    *y = p0->y;
+    *theta = p0->theta;
+    return 0;
+  }
+
+  float dt = (unsigned long)(p1->time - p0->time);
+  float u = dt > 0. ? (long)(time - p0->time) / dt : 0.;
+  float dtheta = p1->theta - p0->theta;
+  if (dtheta > M_PI) {
+    dtheta -= 2.*M_PI;
+  } else if (dtheta < -M_PI) {
+    dtheta += 2.*M_PI;
+  }
+  *x = p0->x + u * (p1->x - p0->x);
+  *y = p0->y + u * (p1->y - p0->y);
+  *theta = p0->theta + u * dtheta;
+
+  return 0;
 }
 
 void Odometry::reset(float x, float y, float theta) {
   x_ = x;
   y_ = y;
   theta_ = theta;
+  trusted_ = true;
+
+  // Positions before the reset are in another frame
+  history_head_ = 0;
+  history_length_ = 0;
+}
+
+boolean Odometry::is_trusted() {
+  return trusted_;
 }
 
 void Odometry::enable_encoders(boolean state) {
@@ -12,11 +12,19 @@
 #include <Arduino.h>
 #include <scheduler.h>
 #include <math.h>
+#include "pin_change.h"
+
+// Maximum number of wheels managed by the odometry
+#define ODOMETRY_MAX_WHEELS 4
+
+// Number of past positions kept to look up the position at a given time
+#define ODOMETRY_HISTORY_SIZE 8
 
 // Forward declaration of "higher" classes for friend declaration
 class DifferentialDrive;
 class SpeedProfiler;
 class Propulsion;
+class SpeedGovernor;
 
 class Odometry : public ScheduledTask {
  public:
@@ -24,6 +32,7 @@ class Odometry : public ScheduledTask {
   friend class DifferentialDrive;
   friend class Propulsion;
   friend class SpeedProfiler;
+  friend class SpeedGovernor;
 
   // Constructor
   //  Build a new odometer
@@ -74,6 +83,39 @@ class Odometry : public ScheduledTask {
              uint8_t front_cod_A, uint8_t front_cod_interrupt_A,
              uint8_t front_cod_B, uint8_t front_cod_interrupt_B);
 
+  // void begin(float front_left_gain, float front_right_gain,
+  //            float rear_left_gain, float rear_right_gain,
+  //            float wheel_radius, float half_length, float half_width,
+  //            uint8_t front_left_cod_A, uint8_t front_left_cod_interrupt_A,
+  //            uint8_t front_left_cod_B, uint8_t front_left_cod_interrupt_B,
+  //            uint8_t front_right_cod_A, uint8_t front_right_cod_interrupt_A,
+  //            uint8_t front_right_cod_B, uint8_t front_right_cod_interrupt_B,
+  //            uint8_t rear_left_cod_A, uint8_t rear_left_cod_interrupt_A,
+  //            uint8_t rear_left_cod_B, uint8_t rear_left_cod_interrupt_B,
+  //            uint8_t rear_right_cod_A, uint8_t rear_right_cod_B);
+  //  Initialize the Odometry object for a four wheels mecanum drive robot
+  //  (rollers in X configuration). The position is updated with the least
+  //  squares solution of the four wheels' displacements.
+  //  As only six external interrupts are available, the rear right encoder
+  //  uses pin change interrupts (see pin_change.h).
+  // Parameters:
+  //  - front_left_gain, ..., rear_right_gain: encoder gains for wheels
+  //  - wheel_radius: wheels' radius
+  //  - half_length: half of the distance between front and rear axles
+  //  - half_width: half of the distance between left and right wheels
+  //  - rear_right_cod_A, rear_right_cod_B: pins supporting pin change
+  //                                        interrupts
+  void begin(float front_left_gain, float front_right_gain,
+             float rear_left_gain, float rear_right_gain,
+             float wheel_radius, float half_length, float half_width,
+             uint8_t front_left_cod_A, uint8_t front_left_cod_interrupt_A,
+             uint8_t front_left_cod_B, uint8_t front_left_cod_interrupt_B,
+             uint8_t front_right_cod_A, uint8_t front_right_cod_interrupt_A,
+             uint8_t front_right_cod_B, uint8_t front_right_cod_interrupt_B,
+             uint8_t rear_left_cod_A, uint8_t rear_left_cod_interrupt_A,
+             uint8_t rear_left_cod_B, uint8_t rear_left_cod_interrupt_B,
+             uint8_t rear_right_cod_A, uint8_t rear_right_cod_B);
+
   // Destructor
   //  Does nothing
   virtual ~Odometry() {};
@@ -91,6 +133,13 @@ class Odometry : public ScheduledTask {
   float get_left_angle();
   float get_right_angle();
   float get_front_angle();
+  float get_wheel_angle(uint8_t wheel);
+
+  // float get_kinematic_residual():
+  //  For mecanum drives, return the part of the last wheels' displacements
+  //  which is not consistent with a rigid body motion (in meters). A large
+  //  value indicates that a wheel is slipping.
+  float get_kinematic_residual();
 
   // void get_position(float *x, float *y, float *theta):
   //   Accessor method to get all state variables from the robot
@@ -100,6 +149,20 @@ class Odometry : public ScheduledTask {
   //  - theta: pointer to the variable in which to store value of theta (in radians)
   void get_position(float *x, float *y, float *theta);
 
+  // char get_position_at(unsigned long time,
+  //                      float *x, float *y, float *theta):
+  //  Get the position of the robot at a given time of the recent past, for
+  //  instance the time of a sensor event. The position is interpolated
+  //  between the last ODOMETRY_HISTORY_SIZE updates, or extrapolated from
+  //  the last one for times after it.
+  // Parameters:
+  //  - time: time in microseconds (micros())
+  //  - x, y, theta: pointers to the variables in which to store the position
+  // Return value:
+  //  -1 if the time is older than the history (or than the last reset).
+  //  Zero if no error is encountered.
+  char get_position_at(unsigned long time, float *x, float *y, float *theta);
+
 
   // void get_angles(float *left, float *right):
   //  Accessor method to get current positions of the motors
@@ -123,29 +186,58 @@ class Odometry : public ScheduledTask {
 
   // void reset(float x, float y, float theta):
   //  Reset the odometry to the given values [x,y,theta]^T
-  //  with x,y in meters and theta in radians
+  //  with x,y in meters and theta in radians.
+  //  The position is considered trusted again after a reset.
   void reset(float x, float y, float theta);
 
+  // boolean is_trusted():
+  //  Return false if a wheel stall or slip has been detected since the last
+  //  reset, in which case the estimated position should not be relied on.
+  boolean is_trusted();
+
   // static void enable_encoders(boolean state):
   //  Activate/deactivate counting tops on the encoders
   // Parameters:
   //  - state: if true the encoders will be activated
   static void enable_encoders(boolean state);
 
-  volatile static uint8_t left_A_, left_B_, right_A_, right_B_, front_A_, front_B_;
-  volatile static unsigned int left_enc_, right_enc_, front_enc_;
+  // Encoders state, indexed by wheel: left (or front left), right (or front
+  // right), front (or rear left) and rear right
+  volatile static uint8_t enc_A_[ODOMETRY_MAX_WHEELS], enc_B_[ODOMETRY_MAX_WHEELS];
+  volatile static unsigned int enc_[ODOMETRY_MAX_WHEELS];
   volatile static boolean enable_encoders_;
  protected:
   enum DriveType {
     differential,
-    omnidirectional
+    omnidirectional,
+    mecanum
   };
+
+  // void init_wheel(uint8_t wheel, float gain, float radius,
+  //                 uint8_t cod_A, uint8_t cod_B):
+  //  Initialize the state and the encoder's pins of one wheel.
+  void init_wheel(uint8_t wheel, float gain, float radius,
+                  uint8_t cod_A, uint8_t cod_B);
+
   float x_, y_, theta_;
-  float left_angle_, right_angle_, front_angle_;
-  float left_gain_, right_gain_, front_gain_;
-  float right_radius_, left_radius_, front_radius_;
-  float shaft_;
-  unsigned int last_left_, last_right_, last_front_;
+
+  // Timestamped positions of the last updates, history_[history_head_]
+  // being the most recent one
+  struct Pose {
+    unsigned long time;
+    float x, y, theta;
+  };
+  Pose history_[ODOMETRY_HISTORY_SIZE];
+  uint8_t history_head_, history_length_;
+  float angle_[ODOMETRY_MAX_WHEELS];
+  float gain_[ODOMETRY_MAX_WHEELS], radius_[ODOMETRY_MAX_WHEELS];
+  // Forward kinematics: robot displacement [x, y, theta] in its own frame
+  // as a function of the wheels' displacements
+  float kinematics_[3][ODOMETRY_MAX_WHEELS];
+  float shaft_, residual_;
+  unsigned int last_enc_[ODOMETRY_MAX_WHEELS];
+  uint8_t n_wheels_;
+  boolean trusted_;
   DriveType type_;
 };
 
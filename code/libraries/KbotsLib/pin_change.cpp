@@ -0,0 +1,64 @@
+/************************************************************************
+ * File : pin_change.cpp                                                *
+ *  Dispatcher for pin change interrupts.                               *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It owns the PCINT0..2 interrupt vectors, so it cannot be used along  *
+ * with other libraries defining them (SoftwareSerial for instance).    *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "pin_change.h"
+
+PinChange::Handler PinChange::handlers_[PIN_CHANGE_MAX_HANDLERS];
+uint8_t PinChange::n_handlers_ = 0;
+
+char PinChange::attach(uint8_t pin, void (*handler)(void)) {
+  volatile uint8_t *pcicr = digitalPinToPCICR(pin);
+  volatile uint8_t *pcmsk = digitalPinToPCMSK(pin);
+
+  if (pcicr == NULL || pcmsk == NULL
+      || n_handlers_ >= PIN_CHANGE_MAX_HANDLERS) {
+    return -1;
+  }
+
+  uint8_t oldSREG = SREG;
+  cli();
+  Handler *h = &handlers_[n_handlers_];
+  h->in = portInputRegister(digitalPinToPort(pin));
+  h->mask = digitalPinToBitMask(pin);
+  h->last = *h->in & h->mask;
+  h->group = digitalPinToPCICRbit(pin);
+  h->handler = handler;
+  n_handlers_++;
+  *pcmsk |= _BV(digitalPinToPCMSKbit(pin));
+  *pcicr |= _BV(digitalPinToPCICRbit(pin));
+  SREG = oldSREG;
+
+  return 0;
+}
+
+void PinChange::dispatch(uint8_t group) {
+  for (uint8_t i=0; i < n_handlers_; i++) {
+    Handler *h = &handlers_[i];
+    if (h->group == group) {
+      uint8_t state = *h->in & h->mask;
+      if (state != h->last) {
+        h->last = state;
+        h->handler();
+      }
+    }
+  }
+}
+
+ISR(PCINT0_vect) {
+  PinChange::dispatch(0);
+}
+
+ISR(PCINT1_vect) {
+  PinChange::dispatch(1);
+}
+
+ISR(PCINT2_vect) {
+  PinChange::dispatch(2);
+}
@@ -0,0 +1,48 @@
+/************************************************************************
+ * File : pin_change.h                                                  *
+ *  Dispatcher for pin change interrupts.                               *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It owns the PCINT0..2 interrupt vectors, so it cannot be used along  *
+ * with other libraries defining them (SoftwareSerial for instance).    *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __PIN_CHANGE_H
+#define __PIN_CHANGE_H
+
+#include <Arduino.h>
+
+// Maximum number of pins which can be watched
+#define PIN_CHANGE_MAX_HANDLERS 8
+
+class PinChange {
+ public:
+  // static char attach(uint8_t pin, void (*handler)(void)):
+  //  Call a function from interrupt context each time the level of a pin
+  //  changes. The pin has to be configured as an input beforehand.
+  // Parameters:
+  //  - pin: pin number (it has to be one of the pin change interrupt pins)
+  //  - handler: function to call
+  // Return value:
+  //  -1 if the pin does not support pin change interrupts or if no more
+  //  handlers are available.
+  //  Zero if no error is encountered.
+  static char attach(uint8_t pin, void (*handler)(void));
+
+  // static void dispatch(uint8_t group):
+  //  For internal use by the interrupt vectors: calls the handlers of the
+  //  pins of a PCINT group whose level changed.
+  static void dispatch(uint8_t group);
+
+ protected:
+  struct Handler {
+    volatile uint8_t *in;
+    uint8_t mask, last, group;
+    void (*handler)(void);
+  };
+  static Handler handlers_[PIN_CHANGE_MAX_HANDLERS];
+  static uint8_t n_handlers_;
+};
+
+#endif // __PIN_CHANGE_H
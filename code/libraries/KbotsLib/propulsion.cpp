@@ -7,6 +7,7 @@
  * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
  ************************************************************************/
 #include "propulsion.h"
+#include <avr/eeprom.h>
 
 #define COS_2PI_3 (-0.5)
 #define SIN_2PI_3 0.8660254037844387
@@ -14,11 +15,70 @@
 #define DEFAULT_MAX_MOTOR_CMD 255
 #define DEFAULT_MAX_INTEGRATOR 255.
 #define DEFAULT_DEAD_ZONE 0
+#define DEFAULT_MAX_WHEEL_SPEED 0.
+
+#define DEFAULT_STALL_CMD 150
+#define DEFAULT_STALL_SPEED 0.5
+#define DEFAULT_STALL_TIME 0.3
+#define DEFAULT_STALL_MAX_CMD 100
+#define DEFAULT_SLIP_MISMATCH 5.
+#define DEFAULT_SLIP_TIME 0.2
+
+// Marker stored in EEPROM before the controller gains
+#define GAINS_EEPROM_MAGIC 0x4B48
 
 Propulsion::Propulsion(unsigned long period) :
   ScheduledTask(period, 0) {
 }
 
+void Propulsion::init_motor(Propulsion::motors motor_id,
+                            uint8_t in1, uint8_t in2, uint8_t en,
+                            float wheel_radius,
+                            float kx, float ky, float ktheta) {
+  pin_in1_[motor_id] = in1;
+  pin_in2_[motor_id] = in2;
+  pin_en_[motor_id] = en;
+  max_cmd_[motor_id] = DEFAULT_MAX_MOTOR_CMD;
+  pos_ref_[motor_id] = 0.;
+  corr_int_[motor_id] = 0.;
+  inv_cmd_[motor_id] = 1;
+  dead_zones_[motor_id] = DEFAULT_DEAD_ZONE;
+  duty_[motor_id] = 0;
+  radius_[motor_id] = wheel_radius;
+  kinematics_[motor_id][0] = kx;
+  kinematics_[motor_id][1] = ky;
+  kinematics_[motor_id][2] = ktheta;
+  last_measures_[motor_id] = 0.;
+  stall_timer_[motor_id] = 0.;
+}
+
+void Propulsion::init_controller(float Kp, float Ki, Odometry *odometer) {
+  for (char i=0; i < PROPULSION_MAX_MOTORS; i++) {
+    Kp_[i] = Kp;
+    Ki_[i] = Ki;
+  }
+  max_int_ = DEFAULT_MAX_INTEGRATOR;
+  max_wheel_speed_ = DEFAULT_MAX_WHEEL_SPEED;
+  lin_speed_limit_ = -1.;
+  speed_scale_ = 1.;
+  autotune_motor_ = -1;
+  odometer_ = odometer;
+
+  stall_cmd_ = DEFAULT_STALL_CMD;
+  stall_speed_ = DEFAULT_STALL_SPEED;
+  stall_time_ = DEFAULT_STALL_TIME;
+  stall_max_cmd_ = DEFAULT_STALL_MAX_CMD;
+  slip_mismatch_ = DEFAULT_SLIP_MISMATCH;
+  slip_time_ = DEFAULT_SLIP_TIME;
+  slip_timer_ = 0.;
+  faults_ = 0;
+  active_faults_ = 0;
+
+  bridge_.begin(n_motors_, pin_in1_, pin_in2_, pin_en_);
+
+  last_control_ = 0;
+}
+
 void Propulsion::begin(uint8_t left_in1, uint8_t left_in2,
                        uint8_t left_en,
                        uint8_t right_in1, uint8_t right_in2,
@@ -30,45 +90,14 @@ void Propulsion::begin(uint8_t left_in1, uint8_t left_in2,
                        float right_wheel_radius) {
 
   type_ = differential;
-
-  pin_in1_[left_motor] = left_in1;
-  pin_in2_[left_motor] = left_in2;
-  pin_en_[left_motor] = left_en;
-  last_dir_[left_motor] = 0;
-  max_cmd_[left_motor] = DEFAULT_MAX_MOTOR_CMD;
-  pos_ref_[left_motor] = 0.;
-  corr_int_[left_motor] = 0.;
-  inv_cmd_[left_motor] = 1;
-  dead_zones_[left_motor] = DEFAULT_DEAD_ZONE;
-
-  pin_in1_[right_motor] = right_in1;
-  pin_in2_[right_motor] = right_in2;
-  pin_en_[right_motor] = right_en;
-  last_dir_[right_motor] = 0;
-  max_cmd_[right_motor] = DEFAULT_MAX_MOTOR_CMD;
-  pos_ref_[right_motor] = 0.;
-  corr_int_[right_motor] = 0.;
-  inv_cmd_[right_motor] = 1;
-  dead_zones_[right_motor] = DEFAULT_DEAD_ZONE;
-
-  Kp_ = Kp;
-  Ki_ = Ki;
+  n_motors_ = 2;
   shaft_ = shaft_width;
-  left_radius_ = left_wheel_radius;
-  right_radius_ = right_wheel_radius;
-  max_int_ = DEFAULT_MAX_INTEGRATOR;
-  odometer_ = odometer;
-
-  for (char i=0; i < 2; i++) {
-    pinMode(pin_in1_[i], OUTPUT);
-    pinMode(pin_in2_[i], OUTPUT);
-    pinMode(pin_en_[i], OUTPUT);
-    digitalWrite(pin_in1_[i], LOW);
-    digitalWrite(pin_in2_[i], LOW);
-    digitalWrite(pin_en_[i], LOW);
-  }
 
-  last_control_ = 0;
+  init_motor(left_motor, left_in1, left_in2, left_en, left_wheel_radius,
+             1., 0., -shaft_ / 2.);
+  init_motor(right_motor, right_in1, right_in2, right_en, right_wheel_radius,
+             1., 0., shaft_ / 2.);
+  init_controller(Kp, Ki, odometer);
 
   // start task now that the object has been initialized
   start_task();
@@ -88,56 +117,48 @@ void Propulsion::begin(uint8_t left_in1, uint8_t left_in2,
                        float front_wheel_radius) {
 
   type_ = omnidirectional;
-
-  pin_in1_[left_motor] = left_in1;
-  pin_in2_[left_motor] = left_in2;
-  pin_en_[left_motor] = left_en;
-  last_dir_[left_motor] = 0;
-  max_cmd_[left_motor] = DEFAULT_MAX_MOTOR_CMD;
-  pos_ref_[left_motor] = 0.;
-  corr_int_[left_motor] = 0.;
-  inv_cmd_[left_motor] = 1;
-  dead_zones_[left_motor] = DEFAULT_DEAD_ZONE;
-
-  pin_in1_[right_motor] = right_in1;
-  pin_in2_[right_motor] = right_in2;
-  pin_en_[right_motor] = right_en;
-  last_dir_[right_motor] = 0;
-  max_cmd_[right_motor] = DEFAULT_MAX_MOTOR_CMD;
-  pos_ref_[right_motor] = 0.;
-  corr_int_[right_motor] = 0.;
-  inv_cmd_[right_motor] = 1;
-  dead_zones_[right_motor] = DEFAULT_DEAD_ZONE;
-
-  pin_in1_[front_motor] = front_in1;
-  pin_in2_[front_motor] = front_in2;
-  pin_en_[front_motor] = front_en;
-  last_dir_[front_motor] = 0;
-  max_cmd_[front_motor] = DEFAULT_MAX_MOTOR_CMD;
-  pos_ref_[front_motor] = 0.;
-  corr_int_[front_motor] = 0.;
-  inv_cmd_[front_motor] = 1;
-  dead_zones_[front_motor] = DEFAULT_DEAD_ZONE;
-
-  Kp_ = Kp;
-  Ki_ = Ki;
+  n_motors_ = 3;
   shaft_ = robot_radius;
-  left_radius_ = left_wheel_radius;
-  right_radius_ = right_wheel_radius;
-  front_radius_ = front_wheel_radius;
-  max_int_ = DEFAULT_MAX_INTEGRATOR;
-  odometer_ = odometer;
 
-  for (char i=0; i < 3; i++) {
-    pinMode(pin_in1_[i], OUTPUT);
-    pinMode(pin_in2_[i], OUTPUT);
-    pinMode(pin_en_[i], OUTPUT);
-    digitalWrite(pin_in1_[i], LOW);
-    digitalWrite(pin_in2_[i], LOW);
-    digitalWrite(pin_en_[i], LOW);
-  }
+  init_motor(left_motor, left_in1, left_in2, left_en, left_wheel_radius,
+             -COS_2PI_3, -SIN_2PI_3, shaft_);
+  init_motor(right_motor, right_in1, right_in2, right_en, right_wheel_radius,
+             -COS_2PI_3, SIN_2PI_3, shaft_);
+  init_motor(front_motor, front_in1, front_in2, front_en, front_wheel_radius,
+             -1., 0., shaft_);
+  init_controller(Kp, Ki, odometer);
 
-  last_control_ = 0;
+  // start task now that the object has been initialized
+  start_task();
+}
+
+void Propulsion::begin(uint8_t front_left_in1, uint8_t front_left_in2,
+                       uint8_t front_left_en,
+                       uint8_t front_right_in1, uint8_t front_right_in2,
+                       uint8_t front_right_en,
+                       uint8_t rear_left_in1, uint8_t rear_left_in2,
+                       uint8_t rear_left_en,
+                       uint8_t rear_right_in1, uint8_t rear_right_in2,
+                       uint8_t rear_right_en,
+                       float Kp, float Ki,
+                       Odometry *odometer,
+                       float wheel_radius,
+                       float half_length,
+                       float half_width) {
+
+  type_ = mecanum;
+  n_motors_ = 4;
+  shaft_ = half_length + half_width;
+
+  init_motor(front_left_motor, front_left_in1, front_left_in2, front_left_en,
+             wheel_radius, 1., -1., -shaft_);
+  init_motor(front_right_motor, front_right_in1, front_right_in2, front_right_en,
+             wheel_radius, 1., 1., shaft_);
+  init_motor(rear_left_motor, rear_left_in1, rear_left_in2, rear_left_en,
+             wheel_radius, 1., 1., -shaft_);
+  init_motor(rear_right_motor, rear_right_in1, rear_right_in2, rear_right_en,
+             wheel_radius, 1., -1., shaft_);
+  init_controller(Kp, Ki, odometer);
 
   // start task now that the object has been initialized
   start_task();
@@ -156,54 +177,32 @@ void Propulsion::set_speeds(float linear_speed_X,
   rot_speed_ref_ = rotational_speed;
 }
 
-void Propulsion::set_motor_mode(Propulsion::motor_mode mode) {
+// Bridge state corresponding to each motor mode
+static HBridge::bridge_state bridge_state_of(Propulsion::motor_mode mode) {
   switch(mode) {
-  case enable:
-    // Stop motor before enabling
-    digitalWrite(pin_in1_[0], LOW);
-    digitalWrite(pin_in2_[0], LOW);
-    digitalWrite(pin_in1_[1], LOW);
-    digitalWrite(pin_in2_[1], LOW);
-    // enable motors
-    digitalWrite(pin_en_[0], HIGH);
-    digitalWrite(pin_en_[1], HIGH);
-    if (type_ == omnidirectional) {
-      digitalWrite(pin_in1_[2], LOW);
-      digitalWrite(pin_in2_[2], LOW);
-      digitalWrite(pin_en_[2], HIGH);
-    }
-    break;
-  case break_high:
-    digitalWrite(pin_in1_[0], HIGH);
-    digitalWrite(pin_in2_[0], HIGH);
-    digitalWrite(pin_in1_[1], HIGH);
-    digitalWrite(pin_in2_[1], HIGH);
-    if (type_ == omnidirectional) {
-      digitalWrite(pin_in1_[2], HIGH);
-      digitalWrite(pin_in2_[2], HIGH);
-    }
-    break;
-  case break_low:
-    digitalWrite(pin_in1_[0], LOW);
-    digitalWrite(pin_in2_[0], LOW);
-    digitalWrite(pin_in1_[1], LOW);
-    digitalWrite(pin_in2_[1], LOW);
-    if (type_ == omnidirectional) {
-      digitalWrite(pin_in1_[2], LOW);
-      digitalWrite(pin_in2_[2], LOW);
-    }
-    break;
-  case disable:
-    digitalWrite(pin_en_[0], LOW);
-    digitalWrite(pin_en_[1], LOW);
-    if (type_ == omnidirectional) {
-      digitalWrite(pin_en_[2], LOW);
-    }
-    break;
+  case Propulsion::break_high:
+    return HBridge::brake_high;
+  case Propulsion::disable:
+    return HBridge::coast;
+  case Propulsion::enable:
+  case Propulsion::break_low:
+  default:
+    // Motors are stopped before being enabled
+    return HBridge::brake_low;
   }
-  last_dir_[0] = 0;
-  last_dir_[1] = 0;
-  last_dir_[2] = 0;
+}
+
+void Propulsion::set_motor_mode(Propulsion::motor_mode mode) {
+  bridge_.set_all_states(bridge_state_of(mode));
+}
+
+void Propulsion::set_motor_mode(Propulsion::motors motor_id,
+                                Propulsion::motor_mode mode) {
+  bridge_.set_state(motor_id, bridge_state_of(mode));
+}
+
+void Propulsion::halt() {
+  bridge_.halt();
 }
 
 void Propulsion::set_max_command(Propulsion::motors motor_id,
@@ -221,6 +220,11 @@ void Propulsion::invert_motor_commands(boolean left, boolean right, boolean fron
   invert_motor_commands(left, right);
   inv_cmd_[front_motor] = front ? -1 : 1;
 }
+void Propulsion::invert_motor_commands(boolean front_left, boolean front_right,
+                                       boolean rear_left, boolean rear_right) {
+  invert_motor_commands(front_left, front_right, rear_left);
+  inv_cmd_[rear_right_motor] = rear_right ? -1 : 1;
+}
 
 void Propulsion::set_dead_zones(int left, int right) {
   dead_zones_[left_motor] = left;
@@ -230,18 +234,121 @@ void Propulsion::set_dead_zones(int left, int right, int front) {
   set_dead_zones(left, right);
   dead_zones_[front_motor] = front;
 }
+void Propulsion::set_dead_zones(int front_left, int front_right,
+                                int rear_left, int rear_right) {
+  set_dead_zones(front_left, front_right, rear_left);
+  dead_zones_[rear_right_motor] = rear_right;
+}
 
 void Propulsion::set_max_integrator(float max_integrator) {
   max_int_ = max_integrator;
 }
 
+void Propulsion::set_max_wheel_speed(float max_speed) {
+  max_wheel_speed_ = fabs(max_speed);
+}
+
+void Propulsion::set_linear_speed_limit(float max_speed) {
+  lin_speed_limit_ = max_speed;
+}
+
+float Propulsion::get_speed_scale() {
+  return speed_scale_;
+}
+
+unsigned int Propulsion::get_total_duty() {
+  unsigned int total = 0;
+  for (uint8_t i=0; i < n_motors_; i++) {
+    if (bridge_.get_state(i) == HBridge::drive) {
+      total += abs(duty_[i]);
+    }
+  }
+  return total;
+}
+
+boolean Propulsion::is_speed_limited() {
+  return speed_scale_ < 1.;
+}
+
+void Propulsion::set_stall_detection(int min_cmd, float max_speed,
+                                     float stall_time, int stall_max_cmd) {
+  stall_cmd_ = abs(min_cmd);
+  stall_speed_ = fabs(max_speed);
+  stall_time_ = stall_time;
+  stall_max_cmd_ = abs(stall_max_cmd);
+}
+
+void Propulsion::set_slip_detection(float max_mismatch, float slip_time) {
+  slip_mismatch_ = fabs(max_mismatch);
+  slip_time_ = slip_time;
+}
+
+uint8_t Propulsion::get_faults() {
+  return faults_;
+}
+
+uint8_t Propulsion::get_active_faults() {
+  return active_faults_;
+}
+
+void Propulsion::clear_faults() {
+  faults_ = 0;
+}
+
+void Propulsion::set_gains(Propulsion::motors motor_id, float Kp, float Ki) {
+  Kp_[motor_id] = Kp;
+  Ki_[motor_id] = Ki;
+}
+
+void Propulsion::get_gains(Propulsion::motors motor_id, float *Kp, float *Ki) {
+  *Kp = Kp_[motor_id];
+  *Ki = Ki_[motor_id];
+}
+
+void Propulsion::save_gains(int eeprom_address) {
+  uint8_t *addr = (uint8_t *)eeprom_address;
+  eeprom_update_word((uint16_t *)addr, GAINS_EEPROM_MAGIC);
+  eeprom_update_block(Kp_, addr + sizeof(uint16_t), sizeof(Kp_));
+  eeprom_update_block(Ki_, addr + sizeof(uint16_t) + sizeof(Kp_), sizeof(Ki_));
+}
+
+char Propulsion::load_gains(int eeprom_address) {
+  uint8_t *addr = (uint8_t *)eeprom_address;
+  if (eeprom_read_word((uint16_t *)addr) != GAINS_EEPROM_MAGIC) {
+    return -1;
+  }
+  eeprom_read_block(Kp_, addr + sizeof(uint16_t), sizeof(Kp_));
+  eeprom_read_block(Ki_, addr + sizeof(uint16_t) + sizeof(Kp_), sizeof(Ki_));
+
+  return 0;
+}
+
+char Propulsion::start_autotune(int relay_cmd, float hysteresis,
+                                uint8_t n_cycles, int eeprom_address) {
+  if (autotune_motor_ >= 0) {
+    return -1;
+  }
+  autotune_cmd_ = relay_cmd;
+  autotune_hyst_ = hysteresis;
+  autotune_cycles_ = n_cycles;
+  autotune_address_ = eeprom_address;
+  autotune_time_ = 0.;
+  autotune_start_ = 1;
+  reset_controller();
+  autotune_motor_ = 0;
+
+  return 0;
+}
+
+char Propulsion::is_autotuning() {
+  return autotune_motor_ >= 0;
+}
+
 void Propulsion::reset_controller() {
-  pos_ref_[left_motor] = odometer_->left_angle_;
-  pos_ref_[right_motor] = odometer_->right_angle_;
-  pos_ref_[front_motor] = odometer_->front_angle_;
-  corr_int_[left_motor] = 0.;
-  corr_int_[right_motor] = 0.;
-  corr_int_[front_motor] = 0.;
+  for (char i=0; i < n_motors_; i++) {
+    pos_ref_[i] = odometer_->angle_[i];
+    corr_int_[i] = 0.;
+  }
 }
 
 void Propulsion::run(void) {
@@ -249,46 +356,62 @@ void Propulsion::run(void) {
 
   unsigned long cur_time = micros();
   float dt = (cur_time - last_control_) / 1e6;
-  float speed_ref[3], measures[3];
-  char max_mots = 0;
+  float speed_ref[PROPULSION_MAX_MOTORS], measures[PROPULSION_MAX_MOTORS];
+  char max_mots = n_motors_;
+  float vx, vy;
 
   if (type_ == differential) {
+    vx = lin_speed_ref_;
+    vy = 0.;
+  } else {
+    // Compute robot speed in local frame of reference
+    vx = lin_speed_X_ref_*cos(odometer_->theta_) + lin_speed_Y_ref_*sin(odometer_->theta_);
+    vy = -lin_speed_X_ref_*sin(odometer_->theta_) + lin_speed_Y_ref_*cos(odometer_->theta_);
+  }
+
+  for (char i=0; i < max_mots; i++) {
     // Get wheel angles measurements
-    measures[0] = odometer_->left_angle_;
-    measures[1] = odometer_->right_angle_;
+    measures[i] = odometer_->angle_[i];
 
     // Compute wheels speed depending on robot's global speeds
-    speed_ref[left_motor] = (2.0*lin_speed_ref_-rot_speed_ref_*shaft_) / (2.0 * left_radius_);
-    speed_ref[right_motor] = (2.0*lin_speed_ref_+rot_speed_ref_*shaft_) / (2.0 * right_radius_);
-
-    max_mots = 2;
-  } else {
-    // Get wheel angles measurements
-    measures[0] = odometer_->left_angle_;
-    measures[1] = odometer_->right_angle_;
-    measures[2] = odometer_->front_angle_;
+    speed_ref[i] = (kinematics_[i][0] * vx
+                    + kinematics_[i][1] * vy
+                    + kinematics_[i][2] * rot_speed_ref_) / radius_[i];
+  }
 
-    // Compute robot speed in local frame of reference
-    float vx = lin_speed_X_ref_*cos(odometer_->theta_) + lin_speed_Y_ref_*sin(odometer_->theta_);
-    float vy = -lin_speed_X_ref_*sin(odometer_->theta_) + lin_speed_Y_ref_*cos(odometer_->theta_);
+  // Hold the robot in place while autotuning
+  if (autotune_motor_ >= 0) {
+    for (char i=0; i < max_mots; i++) {
+      speed_ref[i] = 0.;
+    }
+  }
 
-    // Compute wheels speed depending on robot's global speeds
-    speed_ref[left_motor] =
-      (-1 * COS_2PI_3 * vx
-       -1 * SIN_2PI_3 * vy
-       + shaft_ * rot_speed_ref_) / left_radius_;
-    speed_ref[right_motor] =
-      (-1 * COS_2PI_3 * vx
-       +1 * SIN_2PI_3 * vy
-       + shaft_ * rot_speed_ref_) / right_radius_;
-    speed_ref[front_motor] =
-      (- vx
-       + shaft_ * rot_speed_ref_) / front_radius_;
-
-    max_mots = 3;
+  // Saturation stage on the linear and wheel speeds: scale all the
+  // references together so that the ratio between wheels (and thus the
+  // curvature) is preserved
+  float scale = 1.;
+  if (lin_speed_limit_ >= 0.) {
+    float lin_speed = sqrt(vx*vx + vy*vy);
+    if (lin_speed > lin_speed_limit_) {
+      scale = lin_speed_limit_ / lin_speed;
+    }
+  }
+  if (max_wheel_speed_ > 0.) {
+    for (char i=0; i < max_mots; i++) {
+      float abs_speed = fabs(speed_ref[i]);
+      if (abs_speed * scale > max_wheel_speed_) {
+        scale = max_wheel_speed_ / abs_speed;
+      }
+    }
+  }
+  if (scale < 1.) {
+    for (char i=0; i < max_mots; i++) {
+      speed_ref[i] *= scale;
+    }
   }
 
-  // Control both motors
+  // Compute commands for all motors
+  float cmd[PROPULSION_MAX_MOTORS];
   for (char i=0; i < max_mots; i++) {
     // Compute new position reference depending on wheel speed
     pos_ref_[i] += speed_ref[i] * dt;
@@ -296,42 +419,142 @@ void Propulsion::run(void) {
     // Compute position error
     float error = pos_ref_[i] - measures[i];
 
-    // Compute integral terms
-    corr_int_[i] += Ki_ * error;
+    // Compute integral terms (frozen on stalled motors to avoid windup)
+    if (!(active_faults_ & (left_stall << i))) {
+      corr_int_[i] += Ki_[i] * error;
+    }
     if (corr_int_[i] > max_int_) {
       corr_int_[i] = max_int_;
     } else if (corr_int_[i] < -max_int_) {
       corr_int_[i] = -max_int_;
     }
 
-    // Compute and apply commands
-    set_motor_cmd((motors)i, Kp_*error + corr_int_[i]);
+    cmd[i] = Kp_[i]*error + corr_int_[i];
+  }
+
+  if (autotune_motor_ >= 0) {
+    char i = autotune_motor_;
+    autotune_time_ += dt;
+    if (autotune_start_) {
+      tuner_.start(autotune_cmd_, autotune_hyst_, measures[i],
+                   autotune_time_, autotune_cycles_);
+      autotune_start_ = 0;
+    }
+    // The relay replaces the PI controller of the motor under test
+    cmd[i] = tuner_.update(autotune_time_, measures[i]);
+    corr_int_[i] = 0.;
+    switch (tuner_.get_state()) {
+    case RelayAutotuner::done:
+      tuner_.compute_pi_gains(period_ * 1e-6, &Kp_[i], &Ki_[i]);
+      // fall through
+    case RelayAutotuner::failed:
+      // Keep previous gains if the experiment failed and go to next motor
+      pos_ref_[i] = measures[i];
+      autotune_start_ = 1;
+      autotune_motor_++;
+      if (autotune_motor_ >= max_mots) {
+        autotune_motor_ = -1;
+        if (autotune_address_ >= 0) {
+          save_gains(autotune_address_);
+        }
+      }
+      break;
+    default:
+      break;
+    }
   }
 
+  // Saturation stage on the commands: if one motor cannot follow, scale all
+  // the commands by the same ratio instead of clipping this motor alone
+  float cmd_scale = 1.;
+  for (char i=0; i < max_mots && autotune_motor_ < 0; i++) {
+    float abs_cmd = fabs(cmd[i]);
+    float max_cmd = get_cmd_limit(i) - dead_zones_[i];
+    if (abs_cmd * cmd_scale > max_cmd && max_cmd > 0) {
+      cmd_scale = max_cmd / abs_cmd;
+    }
+  }
+
+  if (autotune_motor_ < 0) {
+    detect_faults(speed_ref, measures, cmd, dt);
+  }
+  for (char i=0; i < max_mots; i++) {
+    last_measures_[i] = measures[i];
+  }
+
+  // Apply commands
+  for (char i=0; i < max_mots; i++) {
+    set_motor_cmd((motors)i, cmd[i] * cmd_scale);
+  }
+
+  // Report limitation to higher level classes. Only the ratio applied to the
+  // speed references is a ratio of speeds: the one of the commands is a
+  // ratio of duty cycles, which says nothing about the speed reached.
+  speed_scale_ = scale;
+
   last_control_ = cur_time;
 }
 
+int Propulsion::get_cmd_limit(char motor_id) {
+  if (active_faults_ & (left_stall << motor_id)) {
+    return min(max_cmd_[motor_id], stall_max_cmd_);
+  }
+  return max_cmd_[motor_id];
+}
+
+void Propulsion::detect_faults(float *speed_ref, float *measures, float *cmd,
+                               float dt) {
+  float err_min = 0., err_max = 0.;
+
+  for (char i=0; i < n_motors_; i++) {
+    uint8_t flag = left_stall << i;
+    float speed = (measures[i] - last_measures_[i]) / dt;
+
+    // Stall: the motor is pushed but the wheel does not turn
+    if (stall_time_ > 0. && fabs(cmd[i]) >= stall_cmd_
+        && fabs(speed) < stall_speed_) {
+      stall_timer_[i] += dt;
+      if (stall_timer_[i] >= stall_time_ && !(active_faults_ & flag)) {
+        active_faults_ |= flag;
+        faults_ |= flag;
+        odometer_->trusted_ = false;
+      }
+    } else {
+      stall_timer_[i] = 0.;
+      active_faults_ &= ~flag;
+    }
+
+    // Speed tracking errors to check the wheels' motions are consistent
+    float err = speed - speed_ref[i];
+    if (i == 0 || err < err_min) err_min = err;
+    if (i == 0 || err > err_max) err_max = err;
+  }
+
+  // Slip: the wheels do not move according to the drive's kinematics
+  if (slip_time_ > 0. && err_max - err_min > slip_mismatch_) {
+    slip_timer_ += dt;
+    if (slip_timer_ >= slip_time_ && !(active_faults_ & wheel_slip)) {
+      active_faults_ |= wheel_slip;
+      faults_ |= wheel_slip;
+      odometer_->trusted_ = false;
+    }
+  } else {
+    slip_timer_ = 0.;
+    active_faults_ &= ~wheel_slip;
+  }
+}
+
 void Propulsion::set_motor_cmd(Propulsion::motors motor_id, int vel) {
+  int max_cmd = get_cmd_limit(motor_id);
   vel *= inv_cmd_[motor_id];
   if (vel > 0) {
     vel += dead_zones_[motor_id];
   } else if (vel < 0) {
     vel -= dead_zones_[motor_id];
   }
-  if (vel > max_cmd_[motor_id]) vel = max_cmd_[motor_id];
-  if (vel < -max_cmd_[motor_id]) vel = -max_cmd_[motor_id];
-
-  if (vel >= 0 && last_dir_[motor_id] != 1) {
-    digitalWrite(pin_in2_[motor_id], LOW);
-    last_dir_[motor_id] = 1;
-  } else if (vel < 0 && last_dir_[motor_id] != -1) {
-    digitalWrite(pin_in1_[motor_id], LOW);
-    last_dir_[motor_id] = -1;
-  }
-  if (vel >= 0) {
-    analogWrite(pin_in1_[motor_id], vel);
-  } else {
-    analogWrite(pin_in2_[motor_id], -vel);
-  }
-}
+  if (vel > max_cmd) vel = max_cmd;
+  if (vel < -max_cmd) vel = -max_cmd;
 
+  duty_[motor_id] = vel;
+  bridge_.set_duty(motor_id, vel);
+}
@@ -12,20 +12,41 @@
 #include <Arduino.h>
 #include <scheduler.h>
 #include "odometry.h"
+#include "relay_autotuner.h"
+#include "hbridge.h"
+
+// Maximum number of motors managed by the object
+#define PROPULSION_MAX_MOTORS 4
 
 // Forward declaration of "higher" classes for friend declaration
 class SpeedProfiler;
+class SpeedGovernor;
 
 class Propulsion : public ScheduledTask {
  public:
   // For internal use by the library
   friend class SpeedProfiler;
+  friend class SpeedGovernor;
 
   // Enumeration for motor description
   enum motors {
     left_motor = 0,
     right_motor = 1,
-    front_motor = 2
+    front_motor = 2,
+    rear_motor = 3,
+    // Names used for mecanum drives
+    front_left_motor = 0,
+    front_right_motor = 1,
+    rear_left_motor = 2,
+    rear_right_motor = 3
+  };
+  // Flags reported by the stall and slip detector
+  enum fault_flags {
+    left_stall = 0x01,
+    right_stall = 0x02,
+    front_stall = 0x04,
+    rear_stall = 0x08,
+    wheel_slip = 0x10
   };
   enum motor_mode {
     enable,
@@ -88,6 +109,32 @@ class Propulsion : public ScheduledTask {
              float robot_radius,
              float left_wheel_radius, float right_wheel_radius, float front_wheel_radius);
 
+  // void begin(uint8_t front_left_in1, uint8_t front_left_in2, uint8_t front_left_en,
+  //            uint8_t front_right_in1, uint8_t front_right_in2, uint8_t front_right_en,
+  //            uint8_t rear_left_in1, uint8_t rear_left_in2, uint8_t rear_left_en,
+  //            uint8_t rear_right_in1, uint8_t rear_right_in2, uint8_t rear_right_en,
+  //            float Kp, float Ki,
+  //            Odometry *odometer,
+  //            float wheel_radius, float half_length, float half_width):
+  //  Initialize the object for four wheels mecanum drives (rollers in X
+  //  configuration). Speeds are then set with the omnidirectional version of
+  //  set_speeds.
+  // Parameters:
+  //  - *_in1, *_in2, *_en: pin numbers of the H-bridges for each motor
+  //  - Kp: proportionnal gain of the wheel position's PI controller
+  //  - Ki: integral gain of the wheel position's PI controller
+  //  - odometer: pointer to the odometry object following the robot movements
+  //  - wheel_radius: radius of the wheels
+  //  - half_length: half of the distance between front and rear axles
+  //  - half_width: half of the distance between left and right wheels
+  void begin(uint8_t front_left_in1, uint8_t front_left_in2, uint8_t front_left_en,
+             uint8_t front_right_in1, uint8_t front_right_in2, uint8_t front_right_en,
+             uint8_t rear_left_in1, uint8_t rear_left_in2, uint8_t rear_left_en,
+             uint8_t rear_right_in1, uint8_t rear_right_in2, uint8_t rear_right_en,
+             float Kp, float Ki,
+             Odometry *odometer,
+             float wheel_radius, float half_length, float half_width);
+
   // void set_speeds(float linear_speed, float rotational_speed):
   //  Set the reference speeds for the control loop in differential drive mode
   // Parameters:
@@ -96,7 +143,8 @@ class Propulsion : public ScheduledTask {
   void set_speeds(float linear_speed, float rotational_speed);
 
   // void set_speeds(float linear_speed_X, float linear_speed_Y, float rotational_speed):
-  //  Set the reference speeds for the control loop in omnidirectional drive mode
+  //  Set the reference speeds for the control loop in omnidirectional and
+  //  mecanum drive modes
   // Parameters:
   //  - linear_speed_X: linear speed of the robot along the X axis in m/s
   //  - linear_speed_Y: linear speed of the robot along the Y axis in m/s
@@ -104,9 +152,23 @@ class Propulsion : public ScheduledTask {
   void set_speeds(float linear_speed_X, float linear_speed_Y, float rotational_speed);
 
   // void set_motor_mode(motor_mode mode):
-  //  Set the working mode of the motor (enabled, free rolling, breaking)
+  //  Set the working mode of the motors (enabled, free rolling, breaking).
+  //  Breaking modes also enable the H-bridges. Enabled or breaking motors
+  //  are driven again by the next control loop update while disabled motors
+  //  stay free rolling until they are enabled.
+  //  Only the pins whose state changes are written.
   void set_motor_mode(motor_mode mode);
 
+  // void set_motor_mode(motors motor_id, motor_mode mode):
+  //  Same as above for only one of the motors.
+  void set_motor_mode(motors motor_id, motor_mode mode);
+
+  // void halt():
+  //  Disable all the H-bridges at once and for good: the motors stay free
+  //  rolling until the next reset, whatever the mode set afterwards. This
+  //  can be called from an interrupt.
+  void halt();
+
   // void set_max_command(motors motor_id, int max_cmd):
   //  Set the maximum command to be applied to one of the motors.
   // Parameters:
@@ -122,17 +184,143 @@ class Propulsion : public ScheduledTask {
   //                 (defaults to false in the constructor)
   void invert_motor_commands(boolean left, boolean right);
   void invert_motor_commands(boolean left, boolean right, boolean front);
+  void invert_motor_commands(boolean front_left, boolean front_right,
+                             boolean rear_left, boolean rear_right);
 
   // void set_dead_zones(int left, int right):
   //  Set the dead zones for each motors. This value will be added to the command
   // sent to the motors when driving them.
   void set_dead_zones(int left, int right);
   void set_dead_zones(int left, int right, int front);
+  void set_dead_zones(int front_left, int front_right,
+                      int rear_left, int rear_right);
+
+  // void set_max_wheel_speed(float max_speed):
+  //  Set the maximum rotational speed of the wheels. When one wheel reference
+  //  goes beyond this value, all the wheel references are scaled down by the
+  //  same ratio so that the trajectory curvature is kept.
+  // Parameters:
+  //  - max_speed: maximum wheel speed in rad/s (0 disables the limitation)
+  void set_max_wheel_speed(float max_speed);
+
+  // void set_linear_speed_limit(float max_speed):
+  //  Set the maximum linear speed of the robot. When the linear speed
+  //  reference goes beyond this value, all the speed references are scaled
+  //  down as for the wheel speed limitation. This is meant to be updated
+  //  continuously, by a SpeedGovernor object for instance.
+  // Parameters:
+  //  - max_speed: maximum linear speed in m/s (negative values disable the
+  //               limitation)
+  void set_linear_speed_limit(float max_speed);
+
+  // float get_speed_scale():
+  //  Return the ratio applied to the speed references during the last control
+  //  loop update by the saturation stage (in ]0;1], 1 if not limited). The
+  //  scaling of the commands, when a motor cannot follow, is not included.
+  float get_speed_scale();
+
+  // unsigned int get_total_duty():
+  //  Return the sum of the absolute duty cycles (in [0; 255]) currently
+  //  applied to the driven motors. It gives an image of the current drawn
+  //  from the battery.
+  unsigned int get_total_duty();
+
+  // boolean is_speed_limited():
+  //  Return true if the saturation stage had to slow down the robot during the
+  //  last control loop update.
+  boolean is_speed_limited();
 
   // void set_max_integrator(float max_integrator):
   //  Set the maximum value of the integral contribution of the PI controller
   void set_max_integrator(float max_integrator);
 
+  // void set_stall_detection(int min_cmd, float max_speed, float stall_time,
+  //                          int stall_max_cmd):
+  //  Configure the stall detector. A motor is considered stalled when its
+  //  command stays above min_cmd while its wheel turns slower than max_speed
+  //  during stall_time. Its command is then limited to stall_max_cmd until
+  //  the wheel moves again, and the odometry is flagged as untrusted.
+  // Parameters:
+  //  - min_cmd: minimum absolute command (before dead zone compensation)
+  //  - max_speed: maximum absolute wheel speed in rad/s
+  //  - stall_time: duration in seconds (0 disables the detector)
+  //  - stall_max_cmd: command limit applied to stalled motors
+  void set_stall_detection(int min_cmd, float max_speed, float stall_time,
+                           int stall_max_cmd);
+
+  // void set_slip_detection(float max_mismatch, float slip_time):
+  //  Configure the slip detector. Wheels are considered slipping when the
+  //  differences between their measured and reference speeds disagree by more
+  //  than max_mismatch during slip_time. The odometry is then flagged as
+  //  untrusted.
+  // Parameters:
+  //  - max_mismatch: maximum spread of the wheel speed errors in rad/s
+  //  - slip_time: duration in seconds (0 disables the detector)
+  void set_slip_detection(float max_mismatch, float slip_time);
+
+  // uint8_t get_faults():
+  //  Return the faults (see fault_flags) raised since the last call to
+  //  clear_faults().
+  uint8_t get_faults();
+
+  // uint8_t get_active_faults():
+  //  Return the faults (see fault_flags) currently detected.
+  uint8_t get_active_faults();
+
+  // void clear_faults():
+  //  Clear the faults returned by get_faults().
+  void clear_faults();
+
+  // void set_gains(motors motor_id, float Kp, float Ki):
+  //  Set the gains of the PI controller of one of the motors.
+  // Parameters:
+  //  - motor_id: ID of the motor
+  //  - Kp: proportionnal gain of the wheel position's PI controller
+  //  - Ki: integral gain of the wheel position's PI controller
+  void set_gains(motors motor_id, float Kp, float Ki);
+
+  // void get_gains(motors motor_id, float *Kp, float *Ki):
+  //  Accessor method to get the gains of the PI controller of one of the motors.
+  void get_gains(motors motor_id, float *Kp, float *Ki);
+
+  // void save_gains(int eeprom_address):
+  //  Store the gains of all the PI controllers in EEPROM.
+  // Parameters:
+  //  - eeprom_address: address of the first byte to use in EEPROM
+  void save_gains(int eeprom_address);
+
+  // char load_gains(int eeprom_address):
+  //  Restore the gains of all the PI controllers from EEPROM.
+  // Parameters:
+  //  - eeprom_address: address given to save_gains
+  // Return value:
+  //  -1 if no gains were stored at this address (gains are left untouched).
+  //  Zero if no error is encountered.
+  char load_gains(int eeprom_address);
+
+  // char start_autotune(int relay_cmd, float hysteresis, uint8_t n_cycles,
+  //                     int eeprom_address):
+  //  Starts the automatic tuning of the PI controllers. A relay feedback
+  //  experiment is run on each motor in turn (the other ones being held in
+  //  position), and the gains computed from the identified critical point are
+  //  applied at the end of each experiment. The robot should be lifted or
+  //  free to move a little during the process.
+  // Parameters:
+  //  - relay_cmd: command applied by the relay (should be well below max_cmd)
+  //  - hysteresis: relay hysteresis on the wheel position in radians
+  //  - n_cycles: number of oscillations to average for each motor
+  //  - eeprom_address: if positive or zero, the gains will be saved at this
+  //                    address at the end of the process
+  // Return value:
+  //  -1 if the object is already autotuning.
+  //  Zero if no error is encountered.
+  char start_autotune(int relay_cmd, float hysteresis, uint8_t n_cycles,
+                      int eeprom_address = -1);
+
+  // char is_autotuning():
+  //  Return non-zero if the automatic tuning is in progress.
+  char is_autotuning();
+
   // void reset_controller():
   //  Set the control loop errors to zero.
   void reset_controller();
@@ -149,21 +337,58 @@ class Propulsion : public ScheduledTask {
   //         [-max_motor_cmd; max_motor_cmd]
   void set_motor_cmd(motors motor_id, int vel);
  protected:
+  // int get_cmd_limit(char motor_id):
+  //  Return the command limit currently applied to one of the motors
+  int get_cmd_limit(char motor_id);
+
+  // void detect_faults(float *speed_ref, float *measures, float *cmd,
+  //                    float dt):
+  //  Stall and slip detection, called from the control loop.
+  void detect_faults(float *speed_ref, float *measures, float *cmd, float dt);
+
+  // void init_motor(motors motor_id, uint8_t in1, uint8_t in2, uint8_t en,
+  //                 float wheel_radius, float kx, float ky, float ktheta):
+  //  Initialize the state of one motor. kx, ky and ktheta give the speed of
+  //  the wheel's contact point as a function of the robot's speeds.
+  void init_motor(motors motor_id, uint8_t in1, uint8_t in2, uint8_t en,
+                  float wheel_radius, float kx, float ky, float ktheta);
+
+  // void init_controller(float Kp, float Ki, Odometry *odometer):
+  //  Initialize the state shared by all motors, once they are initialized.
+  void init_controller(float Kp, float Ki, Odometry *odometer);
+
   enum PropulsionType {
     differential,
-    omnidirectional
+    omnidirectional,
+    mecanum
   };
 
-  uint8_t pin_in1_[3], pin_in2_[3], pin_en_[3];
-  float pos_ref_[3], corr_int_[3];
+  uint8_t pin_in1_[PROPULSION_MAX_MOTORS], pin_in2_[PROPULSION_MAX_MOTORS];
+  uint8_t pin_en_[PROPULSION_MAX_MOTORS], n_motors_;
+  float pos_ref_[PROPULSION_MAX_MOTORS], corr_int_[PROPULSION_MAX_MOTORS];
   float lin_speed_X_ref_, lin_speed_Y_ref_, lin_speed_ref_, rot_speed_ref_;
-  float shaft_, left_radius_, right_radius_, front_radius_;
-  char last_dir_[3];
-  int max_cmd_[3], inv_cmd_[3], dead_zones_[3];
-  float max_int_, Kp_, Ki_;
+  float shaft_, radius_[PROPULSION_MAX_MOTORS];
+  // Inverse kinematics: speed of each wheel's contact point as a function
+  // of the robot's speeds [x, y, theta] in its own frame
+  float kinematics_[PROPULSION_MAX_MOTORS][3];
+  int max_cmd_[PROPULSION_MAX_MOTORS], inv_cmd_[PROPULSION_MAX_MOTORS];
+  int dead_zones_[PROPULSION_MAX_MOTORS], duty_[PROPULSION_MAX_MOTORS];
+  float max_int_, Kp_[PROPULSION_MAX_MOTORS], Ki_[PROPULSION_MAX_MOTORS];
+  float max_wheel_speed_, lin_speed_limit_, speed_scale_;
   Odometry *odometer_;
   unsigned long last_control_;
   PropulsionType type_;
+  float last_measures_[PROPULSION_MAX_MOTORS], stall_timer_[PROPULSION_MAX_MOTORS];
+  float slip_timer_;
+  float stall_speed_, stall_time_, slip_mismatch_, slip_time_;
+  int stall_cmd_, stall_max_cmd_;
+  uint8_t faults_, active_faults_;
+  HBridge bridge_;
+  RelayAutotuner tuner_;
+  char autotune_motor_, autotune_start_;
+  int autotune_cmd_, autotune_address_;
+  float autotune_hyst_, autotune_time_;
+  uint8_t autotune_cycles_;
 };
 
 #endif
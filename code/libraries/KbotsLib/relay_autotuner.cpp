@@ -0,0 +1,110 @@
+/************************************************************************
+ * File : relay_autotuner.cpp                                           *
+ *  Relay feedback (Astrom-Hagglund) experiment to tune PI controllers. *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It does not depend on the Arduino core so that it can also be built  *
+ * on a host computer against a simulated motor.                        *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "relay_autotuner.h"
+
+// Ziegler-Nichols coefficients for PI controllers
+#define ZN_PI_KP 0.45
+#define ZN_PI_TI 0.8333333333333334 // 1/1.2
+
+RelayAutotuner::RelayAutotuner() {
+  state_ = idle;
+  output_ = 0.;
+  Ku_ = 0.;
+  Tu_ = 0.;
+}
+
+void RelayAutotuner::start(float relay_cmd, float hysteresis, float setpoint,
+                           float time, uint8_t n_cycles) {
+  relay_cmd_ = fabs(relay_cmd);
+  hysteresis_ = fabs(hysteresis);
+  setpoint_ = setpoint;
+  n_cycles_ = n_cycles > 0 ? n_cycles : 1;
+  cycle_ = 0;
+  sum_period_ = 0.;
+  sum_amplitude_ = 0.;
+  y_max_ = setpoint;
+  y_min_ = setpoint;
+  last_switch_ = time;
+  last_up_switch_ = time;
+  Ku_ = 0.;
+  Tu_ = 0.;
+  output_ = relay_cmd_;
+  state_ = running;
+}
+
+float RelayAutotuner::update(float time, float measure) {
+  if (state_ != running) {
+    return 0.;
+  }
+
+  // Track the extrema of the current oscillation
+  if (measure > y_max_) y_max_ = measure;
+  if (measure < y_min_) y_min_ = measure;
+
+  float error = setpoint_ - measure;
+  if (output_ > 0. && error < -hysteresis_) {
+    output_ = -relay_cmd_;
+    last_switch_ = time;
+  } else if (output_ < 0. && error > hysteresis_) {
+    output_ = relay_cmd_;
+    last_switch_ = time;
+
+    // One full oscillation ends on each upward switch. The first one is
+    // a transient and is not taken into account.
+    if (cycle_ >= 2) {
+      sum_period_ += time - last_up_switch_;
+      sum_amplitude_ += (y_max_ - y_min_) / 2.;
+    }
+    cycle_++;
+    last_up_switch_ = time;
+    y_max_ = measure;
+    y_min_ = measure;
+
+    if (cycle_ >= n_cycles_ + 2) {
+      float amplitude = sum_amplitude_ / n_cycles_;
+      if (amplitude > hysteresis_) {
+        // Describing function of a relay with hysteresis
+        Ku_ = 4. * relay_cmd_ / (M_PI * sqrt(amplitude * amplitude
+                                             - hysteresis_ * hysteresis_));
+        Tu_ = sum_period_ / n_cycles_;
+        state_ = done;
+      } else {
+        state_ = failed;
+      }
+      output_ = 0.;
+    }
+  }
+
+  // The process does not oscillate
+  if (state_ == running && time - last_switch_ > DEFAULT_AUTOTUNE_TIMEOUT) {
+    state_ = failed;
+    output_ = 0.;
+  }
+
+  return output_;
+}
+
+char RelayAutotuner::get_state() {
+  return state_;
+}
+
+float RelayAutotuner::get_ultimate_gain() {
+  return Ku_;
+}
+
+float RelayAutotuner::get_ultimate_period() {
+  return Tu_;
+}
+
+void RelayAutotuner::compute_pi_gains(float period, float *Kp, float *Ki) {
+  *Kp = ZN_PI_KP * Ku_;
+  *Ki = *Kp * period / (ZN_PI_TI * Tu_);
+}
@@ -0,0 +1,86 @@
+/************************************************************************
+ * File : relay_autotuner.h                                             *
+ *  Relay feedback (Astrom-Hagglund) experiment to tune PI controllers. *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It does not depend on the Arduino core so that it can also be built  *
+ * on a host computer against a simulated motor.                        *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __RELAY_AUTOTUNER_H
+#define __RELAY_AUTOTUNER_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Time without any relay switch after which the experiment is aborted (s)
+#define DEFAULT_AUTOTUNE_TIMEOUT 2.0
+
+class RelayAutotuner {
+ public:
+  // Enumeration for internal state machine
+  enum autotune_state {
+    idle = 0,
+    running,
+    done,
+    failed
+  };
+
+  // Constructor:
+  //  Builds a new (idle) RelayAutotuner object
+  RelayAutotuner();
+
+  // void start(float relay_cmd, float hysteresis, float setpoint,
+  //            float time, uint8_t n_cycles):
+  //  Starts a new relay experiment.
+  // Parameters:
+  //  - relay_cmd: amplitude of the command applied by the relay (positive)
+  //  - hysteresis: half width of the relay hysteresis, in the unit of
+  //                the measure. It should be larger than the measure noise.
+  //  - setpoint: value around which the measure will oscillate
+  //  - time: current time in seconds
+  //  - n_cycles: number of oscillations to average once the first one
+  //              (transient) has been discarded
+  void start(float relay_cmd, float hysteresis, float setpoint,
+             float time, uint8_t n_cycles);
+
+  // float update(float time, float measure):
+  //  Feeds a new sample to the experiment.
+  // Parameters:
+  //  - time: current time in seconds
+  //  - measure: current measure of the process output
+  // Return value:
+  //  Command to apply to the process (zero once the experiment is over)
+  float update(float time, float measure);
+
+  // char get_state():
+  //  Return the current state of the experiment (see autotune_state)
+  char get_state();
+
+  // float get_ultimate_gain():
+  // float get_ultimate_period():
+  //  Accessors to the identified critical point of the process. They are only
+  //  meaningful when the experiment is done.
+  float get_ultimate_gain();
+  float get_ultimate_period();
+
+  // void compute_pi_gains(float period, float *Kp, float *Ki):
+  //  Compute PI gains from the critical point using Ziegler-Nichols rules.
+  // Parameters:
+  //  - period: period of the control loop in seconds. The integral gain is
+  //            expressed per control step (as used by Propulsion).
+  //  - Kp: pointer to the variable in which to store the proportional gain
+  //  - Ki: pointer to the variable in which to store the integral gain
+  void compute_pi_gains(float period, float *Kp, float *Ki);
+
+ protected:
+  float relay_cmd_, hysteresis_, setpoint_, output_;
+  float last_switch_, last_up_switch_, y_max_, y_min_;
+  float sum_period_, sum_amplitude_;
+  float Ku_, Tu_;
+  uint8_t n_cycles_, cycle_;
+  char state_;
+};
+
+#endif // __RELAY_AUTOTUNER_H
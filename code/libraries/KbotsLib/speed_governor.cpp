@@ -0,0 +1,111 @@
+/************************************************************************
+ * File : speed_governor.cpp                                            *
+ *  Class to limit the speed of the robot depending on the free         *
+ *  distance measured by IR range sensors.                              *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "speed_governor.h"
+
+// Linear speeds below this value are considered as no translation
+#define GOVERNOR_MIN_SPEED 0.001
+// Value of the limit when the way is free
+#define GOVERNOR_NO_LIMIT 10.
+
+SpeedGovernor::SpeedGovernor(unsigned long period) :
+            ScheduledTask(period, 0) {
+  n_sensors_ = 0;
+  ranges_ = NULL;
+  set_cone(DEFAULT_GOVERNOR_CONE);
+}
+
+void SpeedGovernor::begin(Propulsion *ddrive, IrRangeArray *ranges,
+                          float deceleration, float margin) {
+  ddrive_ = ddrive;
+  ranges_ = ranges;
+  deceleration_ = deceleration;
+  margin_ = margin;
+  free_distance_ = INFINITY;
+  limit_ = GOVERNOR_NO_LIMIT;
+  last_run_ = micros();
+
+  // start task now that the object has been initialized
+  start_task();
+}
+
+char SpeedGovernor::add_sensor(uint8_t sensor, float direction,
+                               float offset) {
+  if (n_sensors_ >= SPEED_GOVERNOR_MAX_SENSORS) {
+    return -1;
+  }
+
+  Sensor *s = &sensors_[n_sensors_];
+  s->index = sensor;
+  s->cos_dir = cos(direction);
+  s->sin_dir = sin(direction);
+  s->offset = offset;
+  n_sensors_++;
+
+  return 0;
+}
+
+void SpeedGovernor::set_cone(float half_angle) {
+  cos_cone_ = cos(half_angle);
+}
+
+float SpeedGovernor::get_free_distance() {
+  return free_distance_;
+}
+
+float SpeedGovernor::get_speed_limit() {
+  return limit_;
+}
+
+void SpeedGovernor::run() {
+  unsigned long cur_time = micros();
+  float dt = (unsigned long)(cur_time - last_run_) * 1e-6;
+  last_run_ = cur_time;
+
+  // Direction of travel in the robot's frame
+  float vx, vy;
+  if (ddrive_->type_ == Propulsion::differential) {
+    vx = ddrive_->lin_speed_ref_;
+    vy = 0.;
+  } else {
+    float theta = ddrive_->odometer_->theta_;
+    vx = ddrive_->lin_speed_X_ref_*cos(theta) + ddrive_->lin_speed_Y_ref_*sin(theta);
+    vy = -ddrive_->lin_speed_X_ref_*sin(theta) + ddrive_->lin_speed_Y_ref_*cos(theta);
+  }
+  float v = sqrt(vx*vx + vy*vy);
+
+  // Free distance seen by the sensors looking in this direction, from the
+  // last snapshot of the array
+  float free_distance = INFINITY;
+  if (v > GOVERNOR_MIN_SPEED) {
+    const IrRangeSnapshot *snapshot = ranges_->get_snapshot();
+    for (uint8_t i=0; i < n_sensors_; i++) {
+      Sensor *s = &sensors_[i];
+      float range = snapshot->range[s->index];
+      if ((s->cos_dir*vx + s->sin_dir*vy) >= cos_cone_ * v
+          && range < ranges_->get_max_range(s->index)) {
+        free_distance = min(free_distance, range - s->offset);
+      }
+    }
+  }
+  free_distance_ = free_distance;
+
+  // Highest speed from which the robot can stop before the margin, the
+  // obstacle being seen one period late: v*T + v^2/(2a) = d
+  float limit = GOVERNOR_NO_LIMIT;
+  if (free_distance < INFINITY) {
+    float d = max(free_distance - margin_, 0.);
+    float aT = deceleration_ * period_ * 1e-6;
+    limit = -aT + sqrt(aT*aT + 2.*deceleration_*d);
+  }
+
+  // Brake at once, but release the limit smoothly
+  limit_ = min(limit, limit_ + deceleration_ * dt);
+  ddrive_->set_linear_speed_limit(limit_);
+}
@@ -0,0 +1,105 @@
+/************************************************************************
+ * File : speed_governor.h                                              *
+ *  Class to limit the speed of the robot depending on the free         *
+ *  distance measured by IR range sensors.                              *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __SPEED_GOVERNOR_H
+#define __SPEED_GOVERNOR_H
+
+#include <Arduino.h>
+#include <scheduler.h>
+#include "propulsion.h"
+#include "odometry.h"
+#include "ir_range_array.h"
+#include <math.h>
+
+// Maximum number of sensors managed by one object
+#define SPEED_GOVERNOR_MAX_SENSORS IR_RANGE_MAX_SENSORS
+
+#define DEFAULT_GOVERNOR_DECELERATION 1.0
+#define DEFAULT_GOVERNOR_MARGIN 0.1
+// Sensors looking at most this angle away from the direction of travel are
+// taken into account
+#define DEFAULT_GOVERNOR_CONE (M_PI/4.)
+
+class SpeedGovernor : public ScheduledTask {
+ public:
+  // Constructor:
+  //  Builds a new SpeedGovernor object
+  // Parameters:
+  //  - period: period of the sensors update in microseconds
+  SpeedGovernor(unsigned long period);
+
+  // void begin(Propulsion *ddrive, IrRangeArray *ranges, float deceleration,
+  //            float margin):
+  //  Initialize the object. The speed limit is applied to the Propulsion
+  //  object which scales down all its references, so that the profiles of
+  //  the SpeedProfiler object are slowed down instead of being distorted.
+  // Parameters:
+  //  - ddrive: pointer to the Propulsion object to limit
+  //  - ranges: pointer to the IrRangeArray object reading the sensors. Its
+  //            calibrated and filtered snapshot is used at each update.
+  //  - deceleration: deceleration the robot can always achieve in m/s^2
+  //                  (defaults to DEFAULT_GOVERNOR_DECELERATION). The limit
+  //                  is also released at this rate when the way clears.
+  //  - margin: distance to keep from the obstacles in meters (defaults to
+  //            DEFAULT_GOVERNOR_MARGIN). It should be larger than the
+  //            minimal range of the sensors, below which they cannot
+  //            measure the distance.
+  void begin(Propulsion *ddrive, IrRangeArray *ranges,
+             float deceleration = DEFAULT_GOVERNOR_DECELERATION,
+             float margin = DEFAULT_GOVERNOR_MARGIN);
+
+  // char add_sensor(uint8_t sensor, float direction, float offset):
+  //  Use a sensor of the IrRangeArray object. Readings at the farthest
+  //  distance of its calibration table are considered as a free way.
+  // Parameters:
+  //  - sensor: index of the sensor returned by IrRangeArray::add_sensor()
+  //  - direction: direction the sensor looks at, in radians in the robot's
+  //               frame (0 is forward, M_PI backward)
+  //  - offset: distance between the sensor and the outline of the robot in
+  //            this direction in meters (positive if the sensor is inside)
+  // Return value:
+  //  -1 if no more sensors can be added.
+  //  Zero if no error is encountered.
+  char add_sensor(uint8_t sensor, float direction, float offset);
+
+  // void set_cone(float half_angle):
+  //  Set the half angle of the cone around the direction of travel in which
+  //  the sensors are used (defaults to DEFAULT_GOVERNOR_CONE).
+  void set_cone(float half_angle);
+
+  // float get_free_distance():
+  //  Return the free distance in the direction of travel measured during the
+  //  last update in meters, INFINITY if no obstacle was seen.
+  float get_free_distance();
+
+  // float get_speed_limit():
+  //  Return the linear speed limit currently applied in m/s.
+  float get_speed_limit();
+
+  // virtual void run():
+  //  Reads the sensors looking in the direction of travel and updates the
+  //  speed limit.
+  virtual void run();
+
+ protected:
+  struct Sensor {
+    uint8_t index;
+    float cos_dir, sin_dir, offset;
+  };
+
+  Sensor sensors_[SPEED_GOVERNOR_MAX_SENSORS];
+  uint8_t n_sensors_;
+  float cos_cone_;
+  float deceleration_, margin_, free_distance_, limit_;
+  unsigned long last_run_;
+  Propulsion *ddrive_;
+  IrRangeArray *ranges_;
+};
+
+#endif // __SPEED_GOVERNOR_H
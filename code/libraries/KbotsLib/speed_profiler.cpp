@@ -8,6 +8,8 @@
  ************************************************************************/
 #include "speed_profiler.h"
 
+int16_t SpeedProfiler::arena_[SPEED_PROFILER_ARENA_SIZE];
+
 SpeedProfiler::SpeedProfiler(unsigned long period) :
             ScheduledTask(period, 0) {
 }
@@ -18,6 +20,16 @@ void SpeedProfiler::begin(Odometry *odometer, Propulsion *ddrive,
   ddrive_ = ddrive;
   Kp_ = Kp_theta;
   is_following_ = none;
+  queue_head_ = 0;
+  queue_length_ = 0;
+  residual_error_ = 0.;
+  meas_x_ = odometer_->x_;
+  meas_y_ = odometer_->y_;
+  meas_theta_ = odometer_->theta_;
+  meas_vx_ = meas_vy_ = meas_omega_ = 0.;
+  meas_time_ = micros();
+  set_final_approach(DEFAULT_APPROACH_GAIN, DEFAULT_LINEAR_TOLERANCE,
+                     DEFAULT_ANGULAR_TOLERANCE, DEFAULT_APPROACH_TIMEOUT);
 
   // start task now that the object has been initialized
   start_task();
@@ -27,23 +39,61 @@ char SpeedProfiler::is_following_profile() {
   return is_following_;
 }
 
+void SpeedProfiler::set_final_approach(float gain, float linear_tolerance,
+                                       float angular_tolerance,
+                                       unsigned long timeout) {
+  approach_gain_ = gain;
+  linear_tolerance_ = linear_tolerance;
+  angular_tolerance_ = angular_tolerance;
+  approach_timeout_ = timeout;
+}
+
+float SpeedProfiler::get_residual_error() {
+  return residual_error_;
+}
+
+float SpeedProfiler::elapsed(unsigned long cur_time) {
+  return (unsigned long)(cur_time - start_time_) * 1e-6;
+}
+
+void SpeedProfiler::start_measure() {
+  traveled_ = 0.;
+  last_x_ = odometer_->x_;
+  last_y_ = odometer_->y_;
+  last_theta_ = odometer_->theta_;
+}
+
+void SpeedProfiler::update_measure() {
+  float x = odometer_->x_, y = odometer_->y_, theta = odometer_->theta_;
+  float dtheta = theta - last_theta_;
+  if (dtheta > M_PI) {
+    dtheta -= 2.*M_PI;
+  } else if (dtheta < -M_PI) {
+    dtheta += 2.*M_PI;
+  }
+
+  if (is_following_ == rotation) {
+    traveled_ += dtheta;
+  } else {
+    // Displacement along the mean heading of the period
+    float heading = last_theta_ + dtheta / 2.;
+    traveled_ += (x - last_x_) * cos(heading) + (y - last_y_) * sin(heading);
+  }
+  last_x_ = x;
+  last_y_ = y;
+  last_theta_ = theta;
+}
 
-char SpeedProfiler::start_linear_profile(float d, float vmax, float amax) {
+
+char SpeedProfiler::start_linear_profile(float d, float vmax, float amax,
+                                         float jmax) {
   if (is_following_ != none) {
     return -1;
   } else {
-    float dlim = vmax*vmax/amax;
-    if (fabs(d)>dlim) {
-      // Normal profile
-      duration_ = (unsigned long)roundf((fabs(d)/vmax+vmax/amax)*1e6);
-    } else {
-      // Degenerated profile (triangular)
-      duration_ = (unsigned long)roundf(sqrt(4.*fabs(d)/amax)*1e6);
-    }
-    vmax_ = d >= 0. ? vmax : -vmax;
-    amax_ = d >= 0. ? amax : -amax;
-    profile_sign_ = d >= 0. ? 1 : -1;
+    profile_.plan(d, vmax, amax, jmax);
+    start_measure();
     start_time_ = micros();
+    last_run_ = start_time_;
     is_following_ = linear;
   }
 
@@ -51,8 +101,9 @@ char SpeedProfiler::start_linear_profile(float d, float vmax, float amax) {
 }
 
 char SpeedProfiler::start_linear_profile_theta(float d, float vmax,
-                                               float amax, float theta_cons) {
-  char res = start_linear_profile(d, vmax, amax);
+                                               float amax, float theta_cons,
+                                               float jmax) {
+  char res = start_linear_profile(d, vmax, amax, jmax);
   if (res == 0) {
     theta_ref_ = theta_cons;
     is_following_ = linear_theta;
@@ -61,6 +112,48 @@ char SpeedProfiler::start_linear_profile_theta(float d, float vmax,
   return res;
 }
 
+char SpeedProfiler::start_holonomic_profile(float dx, float dy, float dtheta,
+                                            float vmax, float amax,
+                                            float omega_max, float alpha_max,
+                                            float jmax, float jrot) {
+  if (is_following_ != none || ddrive_->type_ == Propulsion::differential) {
+    return -1;
+  }
+
+  MotionLimits limits = {vmax, amax, jmax, omega_max, alpha_max, jrot};
+  plan_holonomic(dx, dy, dtheta, limits);
+  start_time_ = micros();
+  last_run_ = start_time_;
+  is_following_ = holonomic;
+
+  return 0;
+}
+
+void SpeedProfiler::plan_holonomic(float dx, float dy, float dtheta,
+                                   const MotionLimits &limits) {
+  // Plan both axes under their own limits
+  float d = sqrt(dx*dx + dy*dy);
+  profile_.plan(d, limits.vmax, limits.amax, limits.jmax);
+  rot_profile_.plan(dtheta, limits.omega_max, limits.alpha_max, limits.jrot);
+
+  // Slow down the shortest one so that both finish together
+  float T_lin = profile_.get_duration(), T_rot = rot_profile_.get_duration();
+  if (T_lin < T_rot) {
+    float k = T_lin / T_rot;
+    profile_.plan(d, limits.vmax*k, limits.amax*k*k, limits.jmax*k*k*k);
+  } else if (T_rot < T_lin) {
+    float k = T_rot / T_lin;
+    rot_profile_.plan(dtheta, limits.omega_max*k, limits.alpha_max*k*k,
+                      limits.jrot*k*k*k);
+  }
+
+  dir_x_ = d > 0. ? dx / d : 0.;
+  dir_y_ = d > 0. ? dy / d : 0.;
+  start_x_ = odometer_->x_;
+  start_y_ = odometer_->y_;
+  start_theta_ = odometer_->theta_;
+}
+
 float SpeedProfiler::find_closest_segment(float theta, unsigned int n_directions) {
   // Find the closest direction
   float elementary_alpha = 2.*M_PI/n_directions;
@@ -78,74 +171,497 @@ float SpeedProfiler::automatic_heading(unsigned int n_directions) {
   return find_closest_segment(odometer_->theta_, n_directions);
 }
 
-char SpeedProfiler::start_rotation_profile(float alpha, float omega_max, float amax) {
+char SpeedProfiler::start_rotation_profile(float alpha, float omega_max,
+                                           float amax, float jmax) {
   if (is_following_ != none) {
     return -1;
   } else {
-    float alphalim = omega_max*omega_max/amax;
-    if (fabs(alpha)>alphalim) {
-      // Normal profile
-      duration_ = (unsigned long)roundf((fabs(alpha)/omega_max+omega_max/amax)*1e6);
-    } else {
-      // Degenerated profile (triangular)
-      duration_ = (unsigned long)roundf(sqrt(4.*fabs(alpha)/amax)*1e6);
-    }
-    vmax_ = alpha >= 0. ? omega_max : -omega_max;
-    amax_ = alpha >= 0. ? amax : -amax;
-    profile_sign_ = alpha >= 0. ? 1 : -1;
+    profile_.plan(alpha, omega_max, amax, jmax);
+    start_measure();
     start_time_ = micros();
+    last_run_ = start_time_;
     is_following_ = rotation;
   }
 
   return 0;
 }
 
-void SpeedProfiler::controlled_stop(float a_lin, float a_rot) {
-  unsigned long cur_time = micros();
-  float cur_speed, acc;
+char SpeedProfiler::queue_linear_profile(float d, float vmax, float amax,
+                                         float jmax) {
+  MotionLimits limits = {vmax, amax, jmax, 0., 0., 0.};
+  return push_move(linear, d, 0., limits) == NULL ? -1 : 0;
+}
 
-  if (is_following_ != none) {
-    // Compute current speed
-    float profile1 = amax_ * (cur_time - start_time_) * 1e-6;
-    float profile2 = amax_ * (duration_ - cur_time + start_time_) * 1e-6;
-    if (profile_sign_ > 0) {
-      cur_speed = min(vmax_, min(profile1, profile2));
+char SpeedProfiler::queue_rotation_profile(float alpha, float omega_max,
+                                           float amax, float jmax) {
+  MotionLimits limits = {0., 0., 0., omega_max, amax, jmax};
+  return push_move(rotation, alpha, 0., limits) == NULL ? -1 : 0;
+}
+
+char SpeedProfiler::queue_arc_profile(float d, float radius, float vmax,
+                                      float amax, float jmax) {
+  if (radius == 0.) {
+    return -1;
+  }
+  MotionLimits limits = {vmax, amax, jmax, 0., 0., 0.};
+  return push_move(arc, d, 1. / radius, limits) == NULL ? -1 : 0;
+}
+
+char SpeedProfiler::go_to(float x, float y, float theta,
+                          const MotionLimits &limits) {
+  char types[3];
+  uint8_t n_moves;
+
+  if (ddrive_->type_ == Propulsion::differential) {
+    types[0] = goto_heading;
+    types[1] = goto_drive;
+    types[2] = goto_final;
+    n_moves = 3;
+  } else {
+    types[0] = goto_holonomic;
+    n_moves = 1;
+  }
+  if (queue_length_ + n_moves > SPEED_PROFILER_QUEUE_SIZE) {
+    return -1;
+  }
+
+  for (uint8_t i=0; i < n_moves; i++) {
+    Move *m = push_move(types[i], 0., 0., limits);
+    m->x = x;
+    m->y = y;
+    m->theta = theta;
+  }
+
+  return 0;
+}
+
+uint8_t SpeedProfiler::get_queue_length() {
+  return queue_length_;
+}
+
+void SpeedProfiler::clear_queue() {
+  queue_length_ = 0;
+}
+
+SpeedProfiler::Move *SpeedProfiler::push_move(char type, float d,
+                                              float curvature,
+                                              const MotionLimits &limits) {
+  if (queue_length_ >= SPEED_PROFILER_QUEUE_SIZE) {
+    return NULL;
+  }
+
+  Move *m = &queue_[(queue_head_ + queue_length_) % SPEED_PROFILER_QUEUE_SIZE];
+  m->type = type;
+  m->d = d;
+  m->curvature = curvature;
+  m->limits = limits;
+  queue_length_++;
+
+  return m;
+}
+
+void SpeedProfiler::axis_limits(const Move *m, float *vmax, float *amax,
+                                float *jmax) {
+  if (m->type == rotation || m->type == goto_heading || m->type == goto_final) {
+    *vmax = m->limits.omega_max;
+    *amax = m->limits.alpha_max;
+    *jmax = m->limits.jrot;
+  } else {
+    *vmax = m->limits.vmax;
+    *amax = m->limits.amax;
+    *jmax = m->limits.jmax;
+  }
+}
+
+float SpeedProfiler::blend_speed(const Move *a, const Move *b) {
+  // The moves of go_to are planned when they start and always stop
+  if (a->type >= goto_heading || b->type >= goto_heading) {
+    return 0.;
+  }
+
+  // Linear moves and arcs share the linear speed
+  char axis_a = (a->type == rotation);
+  char axis_b = (b->type == rotation);
+  if (axis_a != axis_b || (a->d >= 0.) != (b->d >= 0.)) {
+    return 0.;
+  }
+
+  // The rotational reference jumps by v.(curvature change) in one period,
+  // each wheel by half of it times the shaft width: this step is kept
+  // within what the wheels reach in one period at the linear acceleration.
+  float dk = fabs(b->curvature - a->curvature);
+  if (dk == 0. || ddrive_->shaft_ <= 0.) {
+    return INFINITY;
+  }
+  float amax = min(a->limits.amax, b->limits.amax);
+  return 2. * amax * (period_ * 1e-6) / (dk * ddrive_->shaft_);
+}
+
+float SpeedProfiler::handoff_speed() {
+  // Backward pass from the end of the queue, where the robot has to stop:
+  // v is the highest speed at which the move k can start.
+  float v = 0.;
+  for (int8_t k = queue_length_ - 1; k >= 0; k--) {
+    const Move *m = &queue_[(queue_head_ + k) % SPEED_PROFILER_QUEUE_SIZE];
+    const Move *prev = k > 0 ?
+      &queue_[(queue_head_ + k - 1) % SPEED_PROFILER_QUEUE_SIZE] : &current_;
+    float vblend = blend_speed(prev, m);
+    if (vblend > 0.) {
+      float vmax, amax, jmax, prev_vmax;
+      axis_limits(m, &vmax, &amax, &jmax);
+      v = MotionProfile::reachable_speed(fabs(m->d), v, amax, jmax);
+      axis_limits(prev, &prev_vmax, &amax, &jmax);
+      v = min(min(v, vblend), min(vmax, prev_vmax));
     } else {
-      cur_speed = max(vmax_, max(profile1, profile2));
+      v = 0.;
     }
+  }
 
-    // Compute stopping time
-    unsigned long stop_time;
-    switch(is_following_) {
-    case linear:
-    case linear_theta:
-      acc = a_lin;
-      break;
-    case rotation:
-      acc = a_rot;
-    default:
-      // Not possible or not implemented
-      return;
+  return v;
+}
+
+void SpeedProfiler::start_next_move(unsigned long start_time, float v0) {
+  current_ = queue_[queue_head_];
+  queue_head_ = (queue_head_ + 1) % SPEED_PROFILER_QUEUE_SIZE;
+  queue_length_--;
+
+  if (current_.type >= goto_heading) {
+    plan_goto(&current_);
+  }
+  if (current_.type != holonomic) {
+    float vmax, amax, jmax;
+    axis_limits(&current_, &vmax, &amax, &jmax);
+    profile_.plan(current_.d, vmax, amax, jmax, v0, handoff_speed());
+    start_measure();
+  }
+  start_time_ = start_time;
+  is_following_ = current_.type;
+  // The axis not driven by the new move has to stay at rest
+  ddrive_->set_speeds(0., 0.);
+}
+
+void SpeedProfiler::plan_goto(Move *m) {
+  float dx = m->x - odometer_->x_, dy = m->y - odometer_->y_;
+  float d = sqrt(dx*dx + dy*dy);
+  float alpha;
+
+  switch (m->type) {
+  case goto_heading:
+    // Turn towards the target, unless it is already reached
+    alpha = d > linear_tolerance_ ? atan2(dy, dx) - odometer_->theta_ : 0.;
+    break;
+  case goto_drive:
+    // Drive straight to the target, holding the bearing measured now so
+    // that the heading error left by the rotation is corrected on the way
+    theta_ref_ = d > linear_tolerance_ ? atan2(dy, dx) : odometer_->theta_;
+    m->d = d;
+    m->type = linear_theta;
+    return;
+  case goto_final:
+  case goto_holonomic:
+  default:
+    alpha = m->theta - odometer_->theta_;
+    break;
+  }
+
+  // Turn the shortest way
+  alpha = fmod(alpha, 2.*M_PI);
+  if (alpha > M_PI) {
+    alpha -= 2.*M_PI;
+  } else if (alpha < -M_PI) {
+    alpha += 2.*M_PI;
+  }
+
+  if (m->type == goto_holonomic) {
+    plan_holonomic(dx, dy, alpha, m->limits);
+    m->type = holonomic;
+  } else {
+    m->d = alpha;
+    m->type = rotation;
+  }
+}
+
+char SpeedProfiler::start_path(const float *x, const float *y,
+                               uint8_t n_points, float vmax, float amax,
+                               float lookahead) {
+  if (is_following_ != none || n_points == 0
+      || n_points >= SPEED_PROFILER_MAX_WAYPOINTS) {
+    return -1;
+  }
+
+  // The path starts from the current position
+  path_x_[0] = odometer_->x_;
+  path_y_[0] = odometer_->y_;
+  for (uint8_t i=0; i < n_points; i++) {
+    path_x_[i+1] = x[i];
+    path_y_[i+1] = y[i];
+  }
+  path_length_ = n_points + 1;
+  path_index_ = 0;
+  path_vmax_ = vmax;
+  path_amax_ = amax;
+  path_speed_ = 0.;
+  lookahead_ = lookahead;
+  last_run_ = micros();
+  is_following_ = path;
+
+  return 0;
+}
+
+char SpeedProfiler::follow_holonomic(float t) {
+  // Pose error with respect to the reference of the profile
+  float s = profile_.position(t);
+  float ex = start_x_ + s * dir_x_ - odometer_->x_;
+  float ey = start_y_ + s * dir_y_ - odometer_->y_;
+  float etheta = start_theta_ + rot_profile_.position(t) - odometer_->theta_;
+  etheta = fmod(etheta, 2.*M_PI);
+  if (etheta > M_PI) {
+    etheta -= 2.*M_PI;
+  } else if (etheta < -M_PI) {
+    etheta += 2.*M_PI;
+  }
+
+  float duration = max(profile_.get_duration(), rot_profile_.get_duration());
+  if (t >= duration) {
+    float e = sqrt(ex*ex + ey*ey);
+    if ((e <= linear_tolerance_ && fabs(etheta) <= angular_tolerance_)
+        || t - duration >= approach_timeout_ * 1e-6) {
+      residual_error_ = e;
+      ddrive_->set_speeds(0., 0., 0.);
+      return 1;
+    }
+  }
+
+  float v = profile_.speed(t);
+  ddrive_->set_speeds(v * dir_x_ + approach_gain_ * ex,
+                      v * dir_y_ + approach_gain_ * ey,
+                      rot_profile_.speed(t) + approach_gain_ * etheta);
+  return 0;
+}
+
+void SpeedProfiler::follow_path(float dt) {
+  float x = odometer_->x_, y = odometer_->y_, theta = odometer_->theta_;
+  float sx, sy, seg_len, u;
+
+  // Project the robot on the path, moving to the next segments once their
+  // end has been passed
+  while (1) {
+    sx = path_x_[path_index_+1] - path_x_[path_index_];
+    sy = path_y_[path_index_+1] - path_y_[path_index_];
+    seg_len = sqrt(sx*sx + sy*sy);
+    u = seg_len > 0. ?
+      ((x - path_x_[path_index_])*sx + (y - path_y_[path_index_])*sy) / (seg_len*seg_len) : 1.;
+    if (u < 1. || path_index_ + 2 >= path_length_) {
       break;
     }
-    stop_time = fabs(cur_speed / acc);
-    // Create false degenerate profile that we follow from the middle point
-    if (stop_time > cur_time) {
-      start_time_ = cur_time - stop_time;
-      duration_ = 2*stop_time;
-    } else {
-      start_time_ = 0;
-      duration_ = cur_time+stop_time;
+    path_index_++;
+  }
+  u = constrain(u, 0., 1.);
+
+  // Distance left to the end of the path and lookahead point
+  float remaining = (1. - u) * seg_len;
+  float to_go = lookahead_ - remaining;
+  float gx = path_x_[path_index_+1], gy = path_y_[path_index_+1];
+  if (to_go < 0.) {
+    gx = path_x_[path_index_] + (u + lookahead_ / seg_len) * sx;
+    gy = path_y_[path_index_] + (u + lookahead_ / seg_len) * sy;
+  }
+  for (uint8_t k = path_index_ + 1; k + 1 < path_length_; k++) {
+    sx = path_x_[k+1] - path_x_[k];
+    sy = path_y_[k+1] - path_y_[k];
+    seg_len = sqrt(sx*sx + sy*sy);
+    if (to_go >= 0. && to_go < seg_len) {
+      gx = path_x_[k] + to_go / seg_len * sx;
+      gy = path_y_[k] + to_go / seg_len * sy;
+    } else if (to_go >= seg_len) {
+      gx = path_x_[k+1];
+      gy = path_y_[k+1];
     }
-    vmax_ = cur_speed;
-    amax_ = vmax_ >= 0. ? acc : -acc;
-    profile_sign_ = vmax_ >= 0. ? 1 : -1;
+    to_go -= seg_len;
+    remaining += seg_len;
+  }
+
+  // Linear speed: ramp from the speed actually reached during the last
+  // period, bounded by the stopping distance
+  float v = path_speed_ * ddrive_->speed_scale_ + path_amax_ * dt;
+  v = min(v, path_vmax_);
+  v = min(v, sqrt(2. * path_amax_ * remaining));
+
+  if (remaining < DEFAULT_PATH_TOLERANCE) {
+    ddrive_->set_speeds(0., 0.);
+    ddrive_->set_speeds(0., 0., 0.);
+    is_following_ = none;
+    return;
+  }
+
+  // Curvature of the arc joining the robot to the lookahead point
+  float dx = gx - x, dy = gy - y;
+  float dist2 = dx*dx + dy*dy;
+  float curvature = 0.;
+  if (dist2 > 0.) {
+    curvature = 2. * (cos(theta)*dy - sin(theta)*dx) / dist2;
+  }
+
+  // Bound the centripetal acceleration
+  if (ddrive_->type_ == Propulsion::differential && fabs(curvature) > 0.) {
+    v = min(v, sqrt(path_amax_ / fabs(curvature)));
+  }
+  path_speed_ = v;
+
+  if (ddrive_->type_ == Propulsion::differential) {
+    ddrive_->set_speeds(v, v * curvature);
+  } else if (dist2 > 0.) {
+    float d = sqrt(dist2);
+    ddrive_->set_speeds(v * dx / d, v * dy / d, 0.);
   }
 }
 
+char SpeedProfiler::start_trajectory(const TrajectorySample *samples,
+                                     uint16_t n_samples,
+                                     unsigned long sample_period) {
+  if (is_following_ != none) {
+    return -1;
+  }
+
+  samples_ = samples;
+  n_samples_ = n_samples;
+  sample_period_ = sample_period;
+  start_time_ = micros();
+  last_run_ = start_time_;
+  is_following_ = trajectory;
+
+  return 0;
+}
+
+char SpeedProfiler::start_rendered_linear_profile(float d, float vmax,
+                                                  float amax, float jmax) {
+  if (is_following_ != none) {
+    return -1;
+  }
+  profile_.plan(d, vmax, amax, jmax);
+  return render_profile(linear);
+}
+
+char SpeedProfiler::start_rendered_rotation_profile(float alpha,
+                                                    float omega_max,
+                                                    float amax, float jmax) {
+  if (is_following_ != none) {
+    return -1;
+  }
+  profile_.plan(alpha, omega_max, amax, jmax);
+  return render_profile(rotation);
+}
+
+char SpeedProfiler::render_profile(char axis) {
+  // Find the number of periods per sample (a power of 2)
+  float period = period_ * 1e-6;
+  float n_periods = ceil(profile_.get_duration() / period);
+  uint8_t shift = 0;
+  while (n_periods > (float)SPEED_PROFILER_ARENA_SIZE * (1 << shift)) {
+    if (++shift > 7) {
+      return -1;
+    }
+  }
+
+  // Each sample is the average speed over its periods
+  float step = period * (1 << shift);
+  float scale = (1 << TRAJECTORY_FRACTION_BITS) / step;
+  float last_pos = 0.;
+  uint16_t n = 0;
+  while (n < SPEED_PROFILER_ARENA_SIZE && n * step < profile_.get_duration()) {
+    float pos = profile_.position((n + 1) * step);
+    arena_[n] = (int16_t)round((pos - last_pos) * scale);
+    last_pos = pos;
+    n++;
+  }
+
+  n_rendered_ = n;
+  rendered_shift_ = shift;
+  rendered_tick_ = 0;
+  rendered_axis_ = axis;
+  is_following_ = rendered;
+
+  return 0;
+}
+
+void SpeedProfiler::measure_speeds(unsigned long cur_time) {
+  float dt = (unsigned long)(cur_time - meas_time_) * 1e-6;
+  if (dt <= 0.) {
+    return;
+  }
+
+  float x = odometer_->x_, y = odometer_->y_, theta = odometer_->theta_;
+  float dtheta = theta - meas_theta_;
+  if (dtheta > M_PI) {
+    dtheta -= 2.*M_PI;
+  } else if (dtheta < -M_PI) {
+    dtheta += 2.*M_PI;
+  }
+  meas_vx_ = (x - meas_x_) / dt;
+  meas_vy_ = (y - meas_y_) / dt;
+  meas_omega_ = dtheta / dt;
+  meas_x_ = x;
+  meas_y_ = y;
+  meas_theta_ = theta;
+  meas_time_ = cur_time;
+}
+
+void SpeedProfiler::get_measured_speeds(float *v, float *omega) {
+  float theta = odometer_->theta_;
+  *v = meas_vx_ * cos(theta) + meas_vy_ * sin(theta);
+  *omega = meas_omega_;
+}
+
+float SpeedProfiler::stop_duration(float v, float omega,
+                                   float a_lin, float a_rot) {
+  float T_lin = a_lin > 0. ? fabs(v) / a_lin : 0.;
+  float T_rot = a_rot > 0. ? fabs(omega) / a_rot : 0.;
+  return max(T_lin, T_rot);
+}
+
+float SpeedProfiler::get_stopping_distance(float a_lin, float a_rot) {
+  float v, omega;
+  if (ddrive_->type_ == Propulsion::differential) {
+    get_measured_speeds(&v, &omega);
+  } else {
+    v = sqrt(meas_vx_*meas_vx_ + meas_vy_*meas_vy_);
+    omega = meas_omega_;
+  }
+
+  // The speed decreases linearly
+  return fabs(v) * stop_duration(v, omega, a_lin, a_rot) / 2.;
+}
+
+void SpeedProfiler::controlled_stop(float a_lin, float a_rot) {
+  float v, omega;
+
+  clear_queue();
+  if (ddrive_->type_ == Propulsion::differential) {
+    get_measured_speeds(&v, &omega);
+    dir_x_ = 1.;
+    dir_y_ = 0.;
+  } else {
+    // Slow down along the measured direction of motion
+    v = sqrt(meas_vx_*meas_vx_ + meas_vy_*meas_vy_);
+    omega = meas_omega_;
+    dir_x_ = v > 0. ? meas_vx_ / v : 0.;
+    dir_y_ = v > 0. ? meas_vy_ / v : 0.;
+  }
+
+  // Both axes stop at the same time, the slowest one at full deceleration
+  float T = stop_duration(v, omega, a_lin, a_rot);
+  profile_.plan_stop(v, T > 0. ? fabs(v) / T : 0., 0.);
+  rot_profile_.plan_stop(omega, T > 0. ? fabs(omega) / T : 0., 0.);
+  start_time_ = micros();
+  last_run_ = start_time_;
+  is_following_ = stopping;
+}
+
 void SpeedProfiler::stop_motion() {
+  clear_queue();
   is_following_ = none;
   ddrive_->set_speeds(0., 0.);
+  ddrive_->set_speeds(0., 0., 0.);
 }
 
 void SpeedProfiler::run(void) {
@@ -153,17 +669,116 @@ void SpeedProfiler::run(void) {
   float new_speed, angle_error, left_speed, right_speed;
   char end_profile = 0;
 
-  if (is_following_ != none) {
-    float profile1 = amax_ * (cur_time - start_time_) * 1e-6;
-    float profile2 = amax_ * (duration_ - cur_time + start_time_) * 1e-6;
-    if (profile_sign_ > 0) {
-      new_speed = min(vmax_, min(profile1, profile2));
+  measure_speeds(cur_time);
+
+  // Start the first move of the queue when idle
+  if (is_following_ == none && queue_length_ > 0) {
+    start_next_move(cur_time, 0.);
+    last_run_ = cur_time;
+  }
+
+  if (is_following_ == stopping) {
+    float t = elapsed(cur_time);
+    float v = profile_.speed(t), omega = rot_profile_.speed(t);
+    if (t >= max(profile_.get_duration(), rot_profile_.get_duration())) {
+      v = 0.;
+      omega = 0.;
+      is_following_ = none;
+    }
+    if (ddrive_->type_ == Propulsion::differential) {
+      ddrive_->set_speeds(v, omega);
+    } else {
+      ddrive_->set_speeds(v * dir_x_, v * dir_y_, omega);
+    }
+    return;
+  }
+
+  if (is_following_ == rendered) {
+    uint16_t k = rendered_tick_ >> rendered_shift_;
+    if (k >= n_rendered_) {
+      ddrive_->set_speeds(0., 0.);
+      is_following_ = none;
+      return;
+    }
+    float speed = arena_[k] * (1. / (1 << TRAJECTORY_FRACTION_BITS));
+    if (rendered_axis_ == rotation) {
+      ddrive_->rot_speed_ref_ = speed;
     } else {
-      new_speed = max(vmax_, max(profile1, profile2));
+      ddrive_->lin_speed_ref_ = speed;
+    }
+    // Hold the sample while the wheel speeds are saturated
+    if (ddrive_->speed_scale_ >= 1.) {
+      rendered_tick_++;
+    }
+    return;
+  }
+
+  if (is_following_ == path) {
+    follow_path((cur_time - last_run_) * 1e-6);
+    last_run_ = cur_time;
+    return;
+  }
+
+  if (is_following_ != none) {
+    // Slow down the profile's time if the wheel speeds were saturated
+    float scale = ddrive_->speed_scale_;
+    if (scale < 1.) {
+      start_time_ += (unsigned long)((1. - scale) * (cur_time - last_run_));
+    }
+    last_run_ = cur_time;
+
+    if (is_following_ == trajectory) {
+      unsigned long k = (cur_time - start_time_) / sample_period_;
+      if (k >= n_samples_) {
+        ddrive_->set_speeds(0., 0.);
+        is_following_ = none;
+      } else {
+        const float scale = 1. / (1 << TRAJECTORY_FRACTION_BITS);
+        ddrive_->lin_speed_ref_ = (int16_t)pgm_read_word(&samples_[k].v) * scale;
+        ddrive_->rot_speed_ref_ = (int16_t)pgm_read_word(&samples_[k].omega) * scale;
+      }
+      return;
     }
-    if (cur_time - start_time_ >= duration_) {
-      end_profile = 1;
-      new_speed = 0.;
+
+    if (is_following_ == holonomic) {
+      if (follow_holonomic(elapsed(cur_time))) {
+        is_following_ = none;
+      }
+      return;
+    }
+
+    update_measure();
+
+    // Only evaluate the segment of the profile planned at start
+    float t = elapsed(cur_time);
+    // Chain the next moves of the queue without losing time when the speed
+    // is handed off, keeping the distance error of the previous move
+    while (t >= profile_.get_duration() && queue_length_ > 0
+           && profile_.get_final_speed() != 0.) {
+      unsigned long end_time = start_time_
+        + (unsigned long)(profile_.get_duration() * 1e6);
+      float lag = traveled_ - profile_.get_distance();
+      start_next_move(end_time, fabs(profile_.get_final_speed()));
+      traveled_ = lag;
+      t = elapsed(cur_time);
+    }
+
+    // Follow the profile while correcting the distance error, then converge
+    // on the target
+    float error = profile_.position(t) - traveled_;
+    if (t < profile_.get_duration()) {
+      new_speed = profile_.speed(t) + approach_gain_ * error;
+    } else {
+      float tolerance = is_following_ == rotation ?
+        angular_tolerance_ : linear_tolerance_;
+      float approach_time = t - profile_.get_duration();
+      if (fabs(error) <= tolerance || approach_time >= approach_timeout_ * 1e-6) {
+        end_profile = 1;
+        residual_error_ = error;
+        new_speed = 0.;
+      } else {
+        new_speed = approach_gain_ * error;
+      }
     }
     switch (is_following_) {
     case linear:
@@ -178,8 +793,8 @@ void SpeedProfiler::run(void) {
         angle_error += 2.*M_PI;
       }
       angle_error *= - Kp_;
-      left_speed = (2.0*new_speed-angle_error*ddrive_->shaft_) / (2.0 * ddrive_->left_radius_);
-      right_speed = (2.0*new_speed+angle_error*ddrive_->shaft_) / (2.0 * ddrive_->right_radius_);
+      left_speed = (2.0*new_speed-angle_error*ddrive_->shaft_) / (2.0 * ddrive_->radius_[Propulsion::left_motor]);
+      right_speed = (2.0*new_speed+angle_error*ddrive_->shaft_) / (2.0 * ddrive_->radius_[Propulsion::right_motor]);
       if (left_speed * right_speed < 0) {
         angle_error = 0.;
       }
@@ -188,6 +803,10 @@ void SpeedProfiler::run(void) {
     case rotation:
       ddrive_->rot_speed_ref_ = new_speed;
       break;
+    case arc:
+      ddrive_->lin_speed_ref_ = new_speed;
+      ddrive_->rot_speed_ref_ = new_speed * current_.curvature;
+      break;
     default:
       break;
     }
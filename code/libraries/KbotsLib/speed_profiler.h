@@ -13,10 +13,42 @@
 #include <scheduler.h>
 #include "propulsion.h"
 #include "odometry.h"
+#include "motion_profile.h"
 #include <math.h>
 
 #define DEFAULT_KP_THETA 3.0
 
+// Final approach: gain of the position loop (1/s), tolerances on the
+// distance (m) and on the angle (rad), and maximum duration (us)
+#define DEFAULT_APPROACH_GAIN 4.0
+#define DEFAULT_LINEAR_TOLERANCE 0.002
+#define DEFAULT_ANGULAR_TOLERANCE 0.01
+#define DEFAULT_APPROACH_TIMEOUT 1000000UL
+
+// Maximum number of moves waiting in the queue
+#define SPEED_PROFILER_QUEUE_SIZE 8
+
+// Maximum number of waypoints of a path (including the starting point)
+#define SPEED_PROFILER_MAX_WAYPOINTS 16
+#define DEFAULT_PATH_TOLERANCE 0.01
+
+// Sample of a precomputed trajectory (see code/tools/trajectory_generator.cpp)
+// Speeds are fixed point numbers with TRAJECTORY_FRACTION_BITS fractional bits
+#define TRAJECTORY_FRACTION_BITS 11
+struct TrajectorySample {
+  int16_t v;      // linear speed in m/s
+  int16_t omega;  // rotational speed in rad/s
+};
+
+// Number of samples of the static buffer in which profiles are rendered
+#define SPEED_PROFILER_ARENA_SIZE 256
+
+// Kinematic limits of a movement
+struct MotionLimits {
+  float vmax, amax, jmax;            // linear: m/s, m/s^2, m/s^3
+  float omega_max, alpha_max, jrot;  // rotational: rad/s, rad/s^2, rad/s^3
+};
+
 class SpeedProfiler : public ScheduledTask {
  public:
   // Enumeration for internal state machine
@@ -25,6 +57,17 @@ class SpeedProfiler : public ScheduledTask {
     linear,
     rotation,
     linear_theta,
+    arc,
+    path,
+    trajectory,
+    holonomic,
+    // Moves of go_to, planned from the pose measured when they start
+    goto_heading,
+    goto_drive,
+    goto_final,
+    goto_holonomic,
+    stopping,
+    rendered,
   };
 
   // Constructor:
@@ -51,7 +94,34 @@ class SpeedProfiler : public ScheduledTask {
   // a speed profile).
   char is_following_profile();
 
-  // char start_linear_profile(float d, float vmax, float amax):
+  // void set_final_approach(float gain, float linear_tolerance,
+  //                         float angular_tolerance, unsigned long timeout):
+  //  Tune the closed loop termination of the linear, rotation and arc
+  //  profiles. During these profiles, the distance (or angle) traveled is
+  //  measured with the Odometry object and the speed is corrected by gain
+  //  times the lag behind the profile. Once the profile's time is over, the
+  //  robot keeps converging on the target with the same gain until it is
+  //  within the tolerance or until the timeout expires.
+  // Parameters:
+  //  - gain: gain of the position loop in 1/s (defaults to
+  //          DEFAULT_APPROACH_GAIN)
+  //  - linear_tolerance: tolerance on the distance in meters (defaults to
+  //                      DEFAULT_LINEAR_TOLERANCE)
+  //  - angular_tolerance: tolerance on the angle in radians (defaults to
+  //                       DEFAULT_ANGULAR_TOLERANCE)
+  //  - timeout: maximum duration of the final approach in microseconds
+  //             (defaults to DEFAULT_APPROACH_TIMEOUT)
+  void set_final_approach(float gain, float linear_tolerance,
+                          float angular_tolerance, unsigned long timeout);
+
+  // float get_residual_error():
+  //  Return the distance (in meters) or angle (in radians) still to travel
+  //  when the last profile ended. Positive values mean that the robot
+  //  stopped short of the target. For holonomic profiles, this is the
+  //  distance between the robot and its target position.
+  float get_residual_error();
+
+  // char start_linear_profile(float d, float vmax, float amax, float jmax):
   //  Starts a profile on the linear speed.
   // Parameters:
   //  - d: distance to move of in meters. Positive values move forward
@@ -60,13 +130,16 @@ class SpeedProfiler : public ScheduledTask {
   //          This value should be positive.
   //  - amax: maximum acceleration in m/s^2 allowed during the movement.
   //          This value should be positive.
+  //  - jmax: maximum jerk in m/s^3 allowed during the movement. When this
+  //          value is positive, the profile is a seven segments S-curve,
+  //          otherwise it is trapezoidal (defaults to 0).
   // Return value:
   //  -1 if the object is already following a profile.
   //  Zero if no error is encountered.
-  char start_linear_profile(float d, float vmax, float amax);
+  char start_linear_profile(float d, float vmax, float amax, float jmax = 0.);
 
   // char start_linear_profile_theta(float d, float vmax, float amax,
-  //                                 float theta_cons):
+  //                                 float theta_cons, float jmax):
   //  Starts a profile on the linear speed, controlling the orientation of
   //  the robot to keep a straight line.
   // Parameters:
@@ -77,10 +150,39 @@ class SpeedProfiler : public ScheduledTask {
   //  - amax: maximum acceleration in m/s^2 allowed during the movement.
   //          This value should be positive.
   //  - theta_cons: heading the robot should keep during the movement in radians.
+  //  - jmax: maximum jerk in m/s^3 (see start_linear_profile)
   // Return value:
   //  -1 if the object is already following a profile.
   //  Zero if no error is encountered.
-  char start_linear_profile_theta(float d, float vmax, float amax, float theta_cons);
+  char start_linear_profile_theta(float d, float vmax, float amax, float theta_cons,
+                                  float jmax = 0.);
+
+  // char start_holonomic_profile(float dx, float dy, float dtheta,
+  //                              float vmax, float amax,
+  //                              float omega_max, float alpha_max,
+  //                              float jmax, float jrot):
+  //  Starts a profile translating and rotating the robot at the same time
+  //  (omnidirectional and mecanum drives only). The translation follows a
+  //  straight line. It is planned under the linear limits and the rotation
+  //  under the rotational ones. The shortest of both profiles is then slowed
+  //  down (v*k, a*k^2, j*k^3) so that they finish together. The pose is
+  //  controlled as for the other profiles (see set_final_approach).
+  // Parameters:
+  //  - dx, dy: translation in meters, in the frame of the odometry
+  //  - dtheta: rotation in radians
+  //  - vmax, amax: maximum linear velocity (m/s) and acceleration (m/s^2)
+  //  - omega_max, alpha_max: maximum rotational velocity (rad/s) and
+  //                          acceleration (rad/s^2)
+  //  - jmax, jrot: maximum linear (m/s^3) and rotational (rad/s^3) jerks
+  //                (see start_linear_profile, default to 0)
+  // Return value:
+  //  -1 if the object is already following a profile or if the robot has a
+  //  differential drive.
+  //  Zero if no error is encountered.
+  char start_holonomic_profile(float dx, float dy, float dtheta,
+                               float vmax, float amax,
+                               float omega_max, float alpha_max,
+                               float jmax = 0., float jrot = 0.);
 
   // float find_closest_direction(float theta, unsigned int n_directions):
   //  Helper method for start_linear_profile_theta.
@@ -109,7 +211,8 @@ class SpeedProfiler : public ScheduledTask {
   //  This value will be expressed in ]-M_PI; M_PI]
   float automatic_heading(unsigned int n_directions);
 
-  // char start_rotation_profile(float alpha, float omega_max, float amax):
+  // char start_rotation_profile(float alpha, float omega_max, float amax,
+  //                             float jmax):
   //  Starts a profile on the rotational speed.
   // Parameters:
   //  - alpha: angle to turn of in radians. Positive values turn in the direct
@@ -119,30 +222,304 @@ class SpeedProfiler : public ScheduledTask {
   //               This value should be positive.
   //  - amax: maximum acceleration in rad/s^2 allowed during the movement.
   //          This value should be positive.
+  //  - jmax: maximum jerk in rad/s^3 (see start_linear_profile)
+  // Return value:
+  //  -1 if the object is already following a profile.
+  //  Zero if no error is encountered.
+  char start_rotation_profile(float alpha, float omega_max, float amax,
+                              float jmax = 0.);
+
+  // char queue_linear_profile(float d, float vmax, float amax, float jmax):
+  // char queue_rotation_profile(float alpha, float omega_max, float amax,
+  //                             float jmax):
+  //  Append a move to the queue. Parameters are the same as those of
+  //  start_linear_profile and start_rotation_profile.
+  //  Queued moves are started one after the other by run(). When two
+  //  consecutive moves are on the same axis and in the same direction, the
+  //  first one ends at a hand-off speed instead of stopping, and the next one
+  //  starts from this speed. Hand-off speeds are computed when a move starts,
+  //  from the moves queued at that time, so that the robot can always stop at
+  //  the end of the queue. Queue all the moves of a path before the first one
+  //  starts (i.e. in the same loop iteration) to blend all of them.
+  //  Between a line and an arc, the rotational speed changes in one period,
+  //  so the hand-off speed is lowered until the resulting step of the wheel
+  //  speeds, v.(curvature change).shaft_width/2, is at most amax times the
+  //  period.
+  // Return value:
+  //  -1 if the queue is full.
+  //  Zero if no error is encountered.
+  char queue_linear_profile(float d, float vmax, float amax, float jmax = 0.);
+  char queue_rotation_profile(float alpha, float omega_max, float amax,
+                              float jmax = 0.);
+
+  // char queue_arc_profile(float d, float radius, float vmax, float amax,
+  //                        float jmax):
+  //  Append an arc to the queue (see queue_linear_profile). The profile is
+  //  followed on the linear speed and the rotational speed is kept
+  //  proportional to it.
+  // Parameters:
+  //  - d: length of the arc in meters. Positive values move forward
+  //       and negative values move backwards.
+  //  - radius: radius of the arc in meters. Positive values turn left and
+  //            negative values turn right. It should not be zero.
+  //  - vmax, amax, jmax: see start_linear_profile
+  // Return value:
+  //  -1 if the queue is full or if radius is zero.
+  //  Zero if no error is encountered.
+  char queue_arc_profile(float d, float radius, float vmax, float amax,
+                         float jmax = 0.);
+
+  // char go_to(float x, float y, float theta, const MotionLimits &limits):
+  //  Append the moves bringing the robot to a given pose to the queue. A
+  //  differential robot turns towards the target, drives to it holding the
+  //  bearing of the target, then turns to the final heading. An omnidirectional or mecanum
+  //  robot translates and rotates at once (see start_holonomic_profile).
+  //  Each move is planned from the pose measured by the Odometry object
+  //  when it starts, so that the errors of a move are corrected by the
+  //  next ones.
+  // Parameters:
+  //  - x, y: target position in meters
+  //  - theta: target heading in radians
+  //  - limits: linear and rotational limits of the moves (the jerks can be
+  //            set to 0 for trapezoidal profiles)
+  // Return value:
+  //  -1 if the queue cannot hold the moves.
+  //  Zero if no error is encountered.
+  char go_to(float x, float y, float theta, const MotionLimits &limits);
+
+  // uint8_t get_queue_length():
+  //  Return the number of moves waiting in the queue (the move currently
+  //  followed is not counted).
+  uint8_t get_queue_length();
+
+  // void clear_queue():
+  //  Remove all the moves waiting in the queue. The current move is not
+  //  affected, use controlled_stop to stop the robot smoothly.
+  void clear_queue();
+
+  // char start_path(const float *x, const float *y, uint8_t n_points,
+  //                  float vmax, float amax, float lookahead):
+  //  Starts following a path with a pure pursuit controller. Each period, the
+  //  robot aims at the point of the path located one lookahead distance ahead
+  //  of its projection on the path. On a differential drive, the rotational
+  //  speed is set to follow the arc joining the robot to this point. Other
+  //  drives move straight towards it without turning.
+  //  The linear speed is limited by vmax, by amax (both for the tangential
+  //  and the centripetal accelerations) and by the distance left to the end
+  //  of the path so that the robot stops on the last waypoint.
+  // Parameters:
+  //  - x, y: arrays of the coordinates of the waypoints in meters. The path
+  //          starts from the current position of the robot. A spline can be
+  //          followed by sampling it densely enough.
+  //  - n_points: number of waypoints (at most SPEED_PROFILER_MAX_WAYPOINTS-1)
+  //  - vmax: maximum velocity in m/s. This value should be positive.
+  //  - amax: maximum acceleration in m/s^2. This value should be positive.
+  //  - lookahead: lookahead distance in meters. Larger values give smoother
+  //               but looser trajectories.
+  // Return value:
+  //  -1 if the object is already following a profile or if the number of
+  //  waypoints is not valid.
+  //  Zero if no error is encountered.
+  char start_path(const float *x, const float *y, uint8_t n_points,
+                  float vmax, float amax, float lookahead);
+
+  // char start_trajectory(const TrajectorySample *samples, uint16_t n_samples,
+  //                        unsigned long sample_period):
+  //  Starts playing back a trajectory computed offline. The speeds of the
+  //  current sample are sent to the Propulsion object without any other
+  //  computation. The trajectory is stretched in time when the wheel speeds
+  //  are saturated, as the other profiles.
+  // Parameters:
+  //  - samples: array of samples stored in program memory (PROGMEM), as
+  //             generated by code/tools/trajectory_generator.cpp
+  //  - n_samples: number of samples
+  //  - sample_period: time between samples in microseconds. This should be
+  //                   the period of the SpeedProfiler object.
   // Return value:
   //  -1 if the object is already following a profile.
   //  Zero if no error is encountered.
-  char start_rotation_profile(float alha, float omega_max, float amax);
+  char start_trajectory(const TrajectorySample *samples, uint16_t n_samples,
+                        unsigned long sample_period);
+
+  // char start_rendered_linear_profile(float d, float vmax, float amax,
+  //                                    float jmax):
+  // char start_rendered_rotation_profile(float alpha, float omega_max,
+  //                                      float amax, float jmax):
+  //  Same as start_linear_profile and start_rotation_profile, but the whole
+  //  profile is computed at start and stored as fixed point speeds in a
+  //  static buffer, one sample per period of the object. run() then only
+  //  reads the current sample, which allows running the object at a high
+  //  rate. Profiles longer than SPEED_PROFILER_ARENA_SIZE periods are stored
+  //  with one sample every 2, 4, ... periods. Each sample holds the average
+  //  speed over its periods so that the distance traveled is exact.
+  //  The playback is open loop (no final approach) and holds the current
+  //  sample while the wheel speeds are saturated.
+  // Return value:
+  //  -1 if the object is already following a profile or if the profile is
+  //  too long (more than 128 times SPEED_PROFILER_ARENA_SIZE periods).
+  //  Zero if no error is encountered.
+  char start_rendered_linear_profile(float d, float vmax, float amax,
+                                     float jmax = 0.);
+  char start_rendered_rotation_profile(float alpha, float omega_max,
+                                       float amax, float jmax = 0.);
 
   // void SpeedProfiler::controlled_stop(float a_lin, float a_rot):
-  //  Stops the robot with a given acceleration
+  //  Stops the robot whatever it is doing and clears the queue. The robot
+  //  slows down from its measured speeds, the linear and rotational speeds
+  //  decreasing linearly down to zero at the same time so that the robot
+  //  keeps its current curvature. The deceleration is not corrected nor
+  //  stretched, so the distance traveled is bounded by get_stopping_distance
+  //  (plus the tracking lag of the Propulsion object).
   // Parameters:
-  //  - a_lin: acceleration to use if we are in a linear profile
-  //  - a_rot: acceleration to use if we are in a rotational profile
+  //  - a_lin: maximum linear deceleration in m/s^2
+  //  - a_rot: maximum rotational deceleration in rad/s^2
   void controlled_stop(float a_lin, float a_rot);
 
+  // float get_stopping_distance(float a_lin, float a_rot):
+  //  Return the distance the robot would travel if controlled_stop was
+  //  called now with the same parameters.
+  float get_stopping_distance(float a_lin, float a_rot);
+
+  // void get_measured_speeds(float *v, float *omega):
+  //  Get the speeds of the robot measured by the Odometry object during the
+  //  last period.
+  // Parameters:
+  //  - v: pointer to the variable in which to store the linear speed (along
+  //       the robot's heading) in m/s
+  //  - omega: pointer to the variable in which to store the rotational speed
+  //           in rad/s
+  void get_measured_speeds(float *v, float *omega);
+
   // void stop_motion():
-  //  Stop the robot "instantly", i.e. without slowing down profile.
+  //  Stop the robot "instantly", i.e. without slowing down profile, and
+  //  clear the queue.
   void stop_motion();
 
   // virtual void run():
-  //  Profile generation loop method
+  //  Profile generation loop method.
+  //  When the Propulsion object reports that it had to limit the wheel speeds,
+  //  the profile is stretched in time by the same ratio so that the robot
+  //  slows down along its trajectory instead of losing its heading.
   virtual void run();
 
  protected:
-  float vmax_, amax_, theta_ref_, Kp_;
-  char is_following_, profile_sign_;
-  unsigned long start_time_, duration_;
+  // Parameters of a queued move. The target pose is only used by the moves
+  // of go_to, whose distance d is computed when they start.
+  struct Move {
+    char type;
+    float d, curvature;
+    float x, y, theta;
+    MotionLimits limits;
+  };
+
+  // Move *push_move(char type, float d, float curvature,
+  //                 const MotionLimits &limits):
+  //  Append a move to the queue.
+  // Return value:
+  //  Pointer to the new move, or NULL if the queue is full
+  Move *push_move(char type, float d, float curvature,
+                  const MotionLimits &limits);
+
+  // static void axis_limits(const Move *m, float *vmax, float *amax,
+  //                         float *jmax):
+  //  Get the limits of the axis driven by a move.
+  static void axis_limits(const Move *m, float *vmax, float *amax, float *jmax);
+
+  // void plan_goto(Move *m):
+  //  Compute the distance of a go_to move from the current pose and turn it
+  //  into a regular move.
+  void plan_goto(Move *m);
+
+  // void plan_holonomic(float dx, float dy, float dtheta,
+  //                     const MotionLimits &limits):
+  //  Plan the profiles of a holonomic move from the current pose.
+  void plan_holonomic(float dx, float dy, float dtheta,
+                      const MotionLimits &limits);
+
+  // void start_next_move(unsigned long start_time, float v0):
+  //  Pop the first move of the queue and start following it.
+  // Parameters:
+  //  - start_time: time at which the move starts in microseconds
+  //  - v0: speed at the start of the move (positive)
+  void start_next_move(unsigned long start_time, float v0);
+
+  // float handoff_speed():
+  //  Compute the highest speed at which the current move can end, given the
+  //  moves waiting in the queue.
+  float handoff_speed();
+
+  // char render_profile(char axis):
+  //  Render profile_ in the arena and start playing it back on the given
+  //  axis (linear or rotation).
+  char render_profile(char axis);
+
+  // void measure_speeds(unsigned long cur_time):
+  //  Estimate the robot's speeds from the poses of the Odometry object.
+  void measure_speeds(unsigned long cur_time);
+
+  // float stop_duration(float v, float omega, float a_lin, float a_rot):
+  //  Return the duration of a controlled stop from the given speeds.
+  static float stop_duration(float v, float omega, float a_lin, float a_rot);
+
+  // float elapsed(unsigned long cur_time):
+  //  Return the time elapsed since the start of the profile in seconds.
+  //  The difference is computed on unsigned longs so that it stays correct
+  //  across an overflow of micros().
+  float elapsed(unsigned long cur_time);
+
+  // void start_measure():
+  //  Reset the distance traveled since the start of the profile.
+  void start_measure();
+
+  // void update_measure():
+  //  Update the distance (or angle) traveled since the start of the profile
+  //  from the Odometry object.
+  void update_measure();
+
+  // char follow_holonomic(float t):
+  //  Compute the speed commands of the holonomic profiles.
+  // Parameters:
+  //  - t: time elapsed since the start of the profile in seconds
+  // Return value:
+  //  Non-zero when the profile is over.
+  char follow_holonomic(float t);
+
+  // void follow_path(float dt):
+  //  Compute the speed commands of the path following mode.
+  // Parameters:
+  //  - dt: time elapsed since the previous call in seconds
+  void follow_path(float dt);
+
+  // float blend_speed(const Move *a, const Move *b):
+  //  Return the highest speed that can be kept between moves a and b, zero
+  //  if they cannot be blended. Between a line and an arc (or two arcs), it
+  //  keeps the step of the wheel speeds due to the change of curvature
+  //  within what the linear acceleration allows in one period.
+  float blend_speed(const Move *a, const Move *b);
+
+  float theta_ref_, Kp_;
+  float traveled_, residual_error_, last_x_, last_y_, last_theta_;
+  float approach_gain_, linear_tolerance_, angular_tolerance_;
+  unsigned long approach_timeout_;
+  char is_following_;
+  unsigned long start_time_, last_run_;
+  MotionProfile profile_, rot_profile_;
+  float start_x_, start_y_, start_theta_, dir_x_, dir_y_;
+  Move current_, queue_[SPEED_PROFILER_QUEUE_SIZE];
+  uint8_t queue_head_, queue_length_;
+  float path_x_[SPEED_PROFILER_MAX_WAYPOINTS], path_y_[SPEED_PROFILER_MAX_WAYPOINTS];
+  float path_vmax_, path_amax_, path_speed_, lookahead_;
+  float meas_x_, meas_y_, meas_theta_, meas_vx_, meas_vy_, meas_omega_;
+  unsigned long meas_time_;
+  // Rendered profiles: samples are shared by all the objects
+  static int16_t arena_[SPEED_PROFILER_ARENA_SIZE];
+  uint16_t n_rendered_, rendered_tick_;
+  uint8_t rendered_shift_;
+  char rendered_axis_;
+  uint8_t path_length_, path_index_;
+  const TrajectorySample *samples_;
+  uint16_t n_samples_;
+  unsigned long sample_period_;
   Odometry *odometer_;
   Propulsion *ddrive_;
 };
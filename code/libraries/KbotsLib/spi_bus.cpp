@@ -0,0 +1,144 @@
+/************************************************************************
+ * File : spi_bus.cpp                                                   *
+ *  Interrupt driven queue of SPI transactions.                         *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It owns the SPI interrupt vector, so the SPI library must not be     *
+ * used at the same time. The hardware SPI clock is on pin 52, MOSI on  *
+ * 51 and MISO on 50 (SPI_SCK of config.h, 42, is not an SPI pin).      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "spi_bus.h"
+
+SpiBus::Device SpiBus::devices_[SPI_MAX_DEVICES];
+uint8_t SpiBus::n_devices_ = 0;
+SpiTransaction * volatile SpiBus::head_ = NULL;
+SpiTransaction *SpiBus::tail_ = NULL;
+uint8_t SpiBus::index_ = 0;
+
+void SpiBus::begin() {
+  // The hardware SS pin has to be an output to stay master
+  digitalWrite(SS, HIGH);
+  pinMode(SS, OUTPUT);
+  pinMode(SCK, OUTPUT);
+  pinMode(MOSI, OUTPUT);
+  pinMode(MISO, INPUT);
+
+  uint8_t oldSREG = SREG;
+  cli();
+  SPCR = _BV(SPE) | _BV(MSTR);
+  head_ = NULL;
+  tail_ = NULL;
+  SREG = oldSREG;
+}
+
+char SpiBus::add_device(uint8_t ss_pin, unsigned long clock, uint8_t mode,
+                        uint8_t bit_order) {
+  if (mode > 3 || n_devices_ >= SPI_MAX_DEVICES) {
+    return -1;
+  }
+
+  // Fastest divider first: F_CPU/2 (rate 0) to F_CPU/128 (rate 6)
+  uint8_t rate = 0;
+  unsigned long f = F_CPU / 2;
+  while (rate < 6 && f > clock) {
+    rate++;
+    f >>= 1;
+  }
+
+  Device *d = &devices_[n_devices_];
+  d->ss_out = portOutputRegister(digitalPinToPort(ss_pin));
+  d->ss_mask = digitalPinToBitMask(ss_pin);
+  d->spcr = _BV(SPIE) | _BV(SPE) | _BV(MSTR) | (mode << CPHA)
+            | (rate >> 1);
+  if (bit_order == LSBFIRST) {
+    d->spcr |= _BV(DORD);
+  }
+  d->spsr = (rate < 6 && !(rate & 0x01)) ? _BV(SPI2X) : 0;
+
+  digitalWrite(ss_pin, HIGH);
+  pinMode(ss_pin, OUTPUT);
+
+  return n_devices_++;
+}
+
+char SpiBus::transfer(SpiTransaction *t, uint8_t device, const uint8_t *tx,
+                      uint8_t *rx, uint8_t length, ScheduledTask *task) {
+  if (device >= n_devices_ || length == 0
+      || t->status == SpiTransaction::queued
+      || t->status == SpiTransaction::in_progress) {
+    return -1;
+  }
+
+  t->device = device;
+  t->tx = tx;
+  t->rx = rx;
+  t->length = length;
+  t->task = task;
+  t->next = NULL;
+
+  uint8_t oldSREG = SREG;
+  cli();
+  t->status = SpiTransaction::queued;
+  if (head_ == NULL) {
+    head_ = t;
+    tail_ = t;
+    start(t);
+  } else {
+    tail_->next = t;
+    tail_ = t;
+  }
+  SREG = oldSREG;
+
+  return 0;
+}
+
+uint8_t SpiBus::is_busy() {
+  return head_ != NULL;
+}
+
+void SpiBus::start(SpiTransaction *t) {
+  Device *d = &devices_[t->device];
+  SPCR = d->spcr;
+  SPSR = d->spsr;
+  *d->ss_out &= ~d->ss_mask;
+  t->status = SpiTransaction::in_progress;
+  index_ = 0;
+  SPDR = t->tx != NULL ? t->tx[0] : SPI_FILL_BYTE;
+}
+
+void SpiBus::transfer_complete() {
+  SpiTransaction *t = head_;
+  uint8_t data = SPDR;
+  if (t == NULL) {
+    return;
+  }
+
+  if (t->rx != NULL) {
+    t->rx[index_] = data;
+  }
+  index_++;
+  if (index_ < t->length) {
+    SPDR = t->tx != NULL ? t->tx[index_] : SPI_FILL_BYTE;
+    return;
+  }
+
+  // End of the transaction: release the device and start the next one
+  Device *d = &devices_[t->device];
+  *d->ss_out |= d->ss_mask;
+  head_ = t->next;
+  t->status = SpiTransaction::done;
+  if (t->task != NULL) {
+    t->task->wake_task();
+  }
+  if (head_ != NULL) {
+    start(head_);
+  } else {
+    tail_ = NULL;
+  }
+}
+
+ISR(SPI_STC_vect) {
+  SpiBus::transfer_complete();
+}
@@ -0,0 +1,123 @@
+/************************************************************************
+ * File : spi_bus.h                                                     *
+ *  Interrupt driven queue of SPI transactions.                         *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ * It owns the SPI interrupt vector, so the SPI library must not be     *
+ * used at the same time. The hardware SPI clock is on pin 52, MOSI on  *
+ * 51 and MISO on 50 (SPI_SCK of config.h, 42, is not an SPI pin).      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __SPI_BUS_H
+#define __SPI_BUS_H
+
+#include <Arduino.h>
+#include <scheduler.h>
+
+// Maximum number of devices on the bus (SPI_SS0..SPI_SS3)
+#define SPI_MAX_DEVICES 4
+
+// Byte sent when a transaction has no data to send
+#define SPI_FILL_BYTE 0xFF
+
+// Transfer of a buffer to or from a device. The structure belongs to the
+// caller and is read and written from the interrupt until its status is
+// done, it must not be modified (nor go out of scope) before.
+struct SpiTransaction {
+  enum transaction_status {
+    idle = 0,
+    queued,
+    in_progress,
+    done
+  };
+
+  // Constructor
+  //  Build an idle transaction
+  SpiTransaction() : status(idle) {};
+
+  uint8_t device;         // index of the device
+  const uint8_t *tx;      // bytes to send, NULL to send SPI_FILL_BYTE
+  uint8_t *rx;            // where to store the received bytes, NULL to
+                          // discard them (can be the same buffer as tx)
+  uint8_t length;         // number of bytes to transfer
+  ScheduledTask *task;    // task woken when the transaction is done
+  volatile uint8_t status;
+  SpiTransaction *next;   // for internal use by the queue
+};
+
+class SpiBus {
+ public:
+  // static void begin():
+  //  Configure the SPI pins and enable the SPI controller as master.
+  static void begin();
+
+  // static char add_device(uint8_t ss_pin, unsigned long clock,
+  //                        uint8_t mode, uint8_t bit_order):
+  //  Declare a device on the bus. Its settings are applied at the start of
+  //  each of its transactions.
+  // Parameters:
+  //  - ss_pin: chip select pin of the device (SPI_SS0..SPI_SS3), active low
+  //  - clock: maximum clock frequency of the device in Hz. The highest
+  //           frequency available below it is used (F_CPU/2 to F_CPU/128).
+  //  - mode: SPI mode (0 to 3)
+  //  - bit_order: MSBFIRST or LSBFIRST
+  // Return value:
+  //  -1 if the mode is invalid or if no more devices can be added.
+  //  Index of the device otherwise.
+  static char add_device(uint8_t ss_pin, unsigned long clock, uint8_t mode,
+                         uint8_t bit_order = MSBFIRST);
+
+  // static char transfer(SpiTransaction *t, uint8_t device, const uint8_t *tx,
+  //                      uint8_t *rx, uint8_t length, ScheduledTask *task):
+  //  Queue a full duplex transfer and return immediately. The bytes are
+  //  exchanged one at a time from the SPI interrupt, the chip select being
+  //  held low for the whole transaction. Transactions are processed in
+  //  the order in which they were queued.
+  //  Each byte costs the time of the interrupt (a few microseconds) at
+  //  high clock frequencies, the main program running in between.
+  // Parameters:
+  //  - t: transaction to fill and queue
+  //  - device: index of the device returned by add_device()
+  //  - tx, rx, length: see SpiTransaction
+  //  - task: task to wake when the transaction is done (can be NULL), its
+  //          run() method should check the status of the transaction
+  // Return value:
+  //  -1 if the transaction is already queued or if the parameters are
+  //  invalid.
+  //  Zero if no error is encountered.
+  static char transfer(SpiTransaction *t, uint8_t device, const uint8_t *tx,
+                       uint8_t *rx, uint8_t length,
+                       ScheduledTask *task = NULL);
+
+  // static uint8_t is_busy():
+  //  Return 1 if a transaction is in progress, 0 otherwise.
+  static uint8_t is_busy();
+
+  // static void transfer_complete():
+  //  For internal use by the interrupt vector: stores the received byte
+  //  and sends the next one.
+  static void transfer_complete();
+
+ protected:
+  // static void start(SpiTransaction *t):
+  //  Select the device of a transaction and send its first byte. Called
+  //  with interrupts disabled.
+  static void start(SpiTransaction *t);
+
+  struct Device {
+    volatile uint8_t *ss_out;
+    uint8_t ss_mask;
+    uint8_t spcr, spsr;
+  };
+
+  static Device devices_[SPI_MAX_DEVICES];
+  static uint8_t n_devices_;
+
+  // Queue of the transactions, the head being in progress
+  static SpiTransaction * volatile head_;
+  static SpiTransaction *tail_;
+  static uint8_t index_;
+};
+
+#endif // __SPI_BUS_H
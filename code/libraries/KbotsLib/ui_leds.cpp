@@ -0,0 +1,111 @@
+/************************************************************************
+ * File : ui_leds.cpp                                                   *
+ *  Class to drive the LEDs of the UI board from a frame buffer.        *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include "ui_leds.h"
+
+UiLeds::UiLeds(unsigned long period) :
+            ScheduledTask(period, 0) {
+  base_period_ = period;
+  n_direct_ = 0;
+  clear();
+}
+
+void UiLeds::init_pin(LedPin *p, uint8_t pin) {
+  uint8_t port = digitalPinToPort(pin);
+  p->out = portOutputRegister(port);
+  p->mode = portModeRegister(port);
+  p->mask = digitalPinToBitMask(pin);
+}
+
+void UiLeds::begin(uint8_t cp_a, uint8_t cp_b, uint8_t cp_c,
+                   const uint8_t *direct, uint8_t n_direct) {
+  // Charlieplexed pins start as high impedance inputs
+  init_pin(&charlie_[0], cp_a);
+  init_pin(&charlie_[1], cp_b);
+  init_pin(&charlie_[2], cp_c);
+  for (uint8_t i=0; i < UI_LEDS_CHARLIE_PINS; i++) {
+    *charlie_[i].mode &= ~charlie_[i].mask;
+    *charlie_[i].out &= ~charlie_[i].mask;
+  }
+
+  n_direct_ = min(n_direct, UI_LEDS_MAX_DIRECT);
+  for (uint8_t i=0; i < n_direct_; i++) {
+    init_pin(&direct_[i], direct[i]);
+    *direct_[i].out &= ~direct_[i].mask;
+    *direct_[i].mode |= direct_[i].mask;
+  }
+
+  clear();
+  row_ = UI_LEDS_CHARLIE_PINS - 1;
+  bit_ = UI_LEDS_BAM_BITS - 1;
+
+  // start task now that the object has been initialized
+  start_task();
+}
+
+void UiLeds::set(uint8_t led, uint8_t brightness) {
+  if (led < UI_LEDS_MAX) {
+    frame_[led] = brightness;
+  }
+}
+
+uint8_t UiLeds::get(uint8_t led) {
+  return led < UI_LEDS_MAX ? frame_[led] : 0;
+}
+
+void UiLeds::clear() {
+  for (uint8_t i=0; i < UI_LEDS_MAX; i++) {
+    frame_[i] = 0;
+  }
+}
+
+uint8_t *UiLeds::get_frame() {
+  return frame_;
+}
+
+void UiLeds::run() {
+  // Next bit, then next row of the charlieplexed LEDs
+  bit_++;
+  if (bit_ >= UI_LEDS_BAM_BITS) {
+    bit_ = 0;
+    row_++;
+    if (row_ >= UI_LEDS_CHARLIE_PINS) {
+      row_ = 0;
+    }
+  }
+  uint8_t mask = 1 << (bit_ + 8 - UI_LEDS_BAM_BITS);
+
+  // Release all the charlieplexed pins before driving the new row to
+  // avoid ghosting
+  for (uint8_t i=0; i < UI_LEDS_CHARLIE_PINS; i++) {
+    *charlie_[i].mode &= ~charlie_[i].mask;
+    *charlie_[i].out &= ~charlie_[i].mask;
+  }
+  uint8_t lit = 0;
+  for (uint8_t c=0; c < UI_LEDS_CHARLIE_PINS; c++) {
+    if (c != row_ && (frame_[UI_LED_CHARLIE(row_, c)] & mask)) {
+      *charlie_[c].mode |= charlie_[c].mask;
+      lit++;
+    }
+  }
+  if (lit > 0) {
+    *charlie_[row_].out |= charlie_[row_].mask;
+    *charlie_[row_].mode |= charlie_[row_].mask;
+  }
+
+  for (uint8_t i=0; i < n_direct_; i++) {
+    if (frame_[UI_LED_DIRECT(i)] & mask) {
+      *direct_[i].out |= direct_[i].mask;
+    } else {
+      *direct_[i].out &= ~direct_[i].mask;
+    }
+  }
+
+  // Each bit is displayed for a time proportional to its weight
+  set_period(base_period_ << bit_);
+}
@@ -0,0 +1,97 @@
+/************************************************************************
+ * File : ui_leds.h                                                     *
+ *  Class to drive the LEDs of the UI board from a frame buffer.        *
+ *                                                                      *
+ * This class is part of the KbotsLib for Arduino.                      *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __UI_LEDS_H
+#define __UI_LEDS_H
+
+#include <Arduino.h>
+#include <scheduler.h>
+
+// Charlieplexed LEDs: 3 pins drive 6 LEDs, 2 of them (sharing the same
+// anode pin) being lit at a time
+#define UI_LEDS_CHARLIE_PINS 3
+#define UI_LEDS_CHARLIE 6
+
+// Maximum number of directly driven LEDs
+#define UI_LEDS_MAX_DIRECT 6
+
+#define UI_LEDS_MAX (UI_LEDS_CHARLIE + UI_LEDS_MAX_DIRECT)
+
+// Index in the frame buffer of a charlieplexed LED lit by driving pin
+// anode high and pin cathode low (indexes of the pins given to begin())
+#define UI_LED_CHARLIE(anode, cathode) (2*(anode) + ((cathode) > (anode) ? (cathode) - 1 : (cathode)))
+// Index in the frame buffer of a directly driven LED
+#define UI_LED_DIRECT(i) (UI_LEDS_CHARLIE + (i))
+
+// Brightness resolution of the bit angle modulation
+#define UI_LEDS_BAM_BITS 4
+
+class UiLeds : public ScheduledTask {
+ public:
+  // Constructor
+  //  Build a new LED driver
+  // Parameters:
+  //  - period: display time of the least significant bit of the brightness
+  //            in microseconds. The task period is changed for each bit
+  //            (period << bit), a full refresh takes
+  //            3 * (2^UI_LEDS_BAM_BITS - 1) * period.
+  UiLeds(unsigned long period);
+
+  // Destructor
+  //  Does nothing
+  virtual ~UiLeds() {};
+
+  // void begin(uint8_t cp_a, uint8_t cp_b, uint8_t cp_c,
+  //            const uint8_t *direct, uint8_t n_direct):
+  //  Initialize the pins and start refreshing the LEDs, all off.
+  // Parameters:
+  //  - cp_a, cp_b, cp_c: pins of the charlieplexed LEDs (UI_LED_CPA..CPC)
+  //  - direct: array of the pins of the directly driven LEDs (active high)
+  //  - n_direct: number of direct LEDs (at most UI_LEDS_MAX_DIRECT)
+  void begin(uint8_t cp_a, uint8_t cp_b, uint8_t cp_c,
+             const uint8_t *direct, uint8_t n_direct);
+
+  // void set(uint8_t led, uint8_t brightness):
+  // uint8_t get(uint8_t led):
+  //  Write (resp. read) the brightness of a LED in the frame buffer, from
+  //  0 (off) to 255 (fully on). Only the UI_LEDS_BAM_BITS most significant
+  //  bits are displayed.
+  void set(uint8_t led, uint8_t brightness);
+  uint8_t get(uint8_t led);
+
+  // void clear():
+  //  Switch all the LEDs off.
+  void clear();
+
+  // uint8_t *get_frame():
+  //  Return the frame buffer (UI_LEDS_MAX brightness values), so that
+  //  displays can be written directly.
+  uint8_t *get_frame();
+
+  // virtual void run():
+  //  Display the next bit of the brightness of the LEDs.
+  virtual void run();
+
+ protected:
+  struct LedPin {
+    volatile uint8_t *out, *mode;
+    uint8_t mask;
+  };
+
+  // void init_pin(LedPin *p, uint8_t pin):
+  //  Fill the port registers of a pin.
+  void init_pin(LedPin *p, uint8_t pin);
+
+  LedPin charlie_[UI_LEDS_CHARLIE_PINS], direct_[UI_LEDS_MAX_DIRECT];
+  uint8_t n_direct_;
+  uint8_t frame_[UI_LEDS_MAX];
+  uint8_t row_, bit_;
+  unsigned long base_period_;
+};
+
+#endif // __UI_LEDS_H
@@ -11,7 +11,7 @@
 // ScheduledTask definitions
 
 ScheduledTask::ScheduledTask(unsigned long period, char run) :
-  period_(period), is_running_(run) {
+  period_(period), is_running_(run), wake_(0) {
   next_run_ = micros();
 }
 
@@ -28,6 +28,10 @@ void ScheduledTask::stop_task() {
   is_running_ = 0;
 }
 
+void ScheduledTask::wake_task() {
+  wake_ = 1;
+}
+
 // Scheduler definitions
 
 ScheduledTask *Scheduler::queued_tasks_[SCHEDULER_MAX_TASKS];
@@ -50,7 +54,9 @@ void Scheduler::update() {
   unsigned long cur_time = 0;
   for (unsigned char i = 0; i < num_tasks_; i++) {
     cur_time = micros();
-    if (cur_time >= queued_tasks_[i]->next_run_) {
+    if (queued_tasks_[i]->wake_ || cur_time >= queued_tasks_[i]->next_run_) {
+      // Cleared before running so that a wake up during run() is not lost
+      queued_tasks_[i]->wake_ = 0;
       queued_tasks_[i]->run();
       queued_tasks_[i]->next_run_ = cur_time + queued_tasks_[i]->period_;
     }
@@ -52,9 +52,15 @@ class ScheduledTask {
   //  Stop the task
   void stop_task();
 
+  // void wake_task():
+  //  Run the task at the next update of the scheduler without waiting for
+  //  the end of its period. This can be called from an interrupt.
+  void wake_task();
+
  protected:
   unsigned long period_, next_run_;
   unsigned char is_running_;
+  volatile unsigned char wake_;
 };
 
 class Scheduler {
@@ -0,0 +1,139 @@
+/************************************************************************
+ * File : autotune_sim.cpp                                              *
+ *  Host regression test of RelayAutotuner against a simulated motor.   *
+ *                                                                      *
+ * Compile with:                                                        *
+ *   g++ -O2 -I../libraries/KbotsLib -o autotune_sim autotune_sim.cpp   *
+ *       ../libraries/KbotsLib/relay_autotuner.cpp                      *
+ * Usage:                                                               *
+ *   autotune_sim                                                       *
+ *  Exits with a non-zero status if a test case fails.                  *
+ *                                                                      *
+ * The motor is a first order plus integrator process with a transport  *
+ * delay, G(s) = K.exp(-L.s) / (s.(tau.s + 1)), simulated with a small  *
+ * time step. Its critical point is known analytically: the phase is    *
+ * -pi at wu such that atan(wu.tau) + wu.L = pi/2, then                 *
+ * Ku = wu.sqrt(1 + (wu.tau)^2) / K and Tu = 2.pi / wu. The relay       *
+ * experiment only approximates it (describing function), so the        *
+ * identified values and the PI gains computed from them are checked    *
+ * within a tolerance.                                                  *
+ *                                                                      *
+ * This tool is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include "relay_autotuner.h"
+
+// Simulation time step and maximum duration of an experiment (s)
+#define SIM_STEP 1e-4
+#define SIM_DURATION 30.
+
+// Control period used to express the integral gain (s), as Propulsion
+#define CONTROL_PERIOD 0.01
+
+// Relative tolerances. The describing function underestimates Ku and
+// overestimates Tu by up to about 10% when the delay is not negligible,
+// Ki = Kp.T/Ti cumulates both errors.
+#define TOLERANCE 0.15
+#define TOLERANCE_KI 0.25
+
+// Relay settings: hysteresis as a fraction of the expected amplitude
+#define RELAY_CMD 60.
+#define RELAY_HYSTERESIS 0.02
+#define RELAY_CYCLES 4
+
+// Ziegler-Nichols PI rules, as in relay_autotuner.cpp
+#define ZN_PI_KP 0.45
+#define ZN_PI_TI (1./1.2)
+
+struct Motor {
+  double K, tau, L;
+};
+
+// Critical frequency of the process, by bisection on the phase
+static double critical_frequency(const Motor &m) {
+  double lo = 0., hi = M_PI / (2. * m.L);
+  for (int i=0; i < 100; i++) {
+    double w = (lo + hi) / 2.;
+    if (atan(w * m.tau) + w * m.L < M_PI / 2.) {
+      lo = w;
+    } else {
+      hi = w;
+    }
+  }
+  return (lo + hi) / 2.;
+}
+
+static bool check(const char *name, double value, double expected,
+                  double tolerance) {
+  double error = fabs(value - expected) / fabs(expected);
+  bool ok = error <= tolerance;
+  printf("  %-3s %10.5f expected %10.5f (%5.1f%%) %s\n", name, value,
+         expected, 100. * error, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool run_case(const Motor &m) {
+  double wu = critical_frequency(m);
+  double Ku = wu * sqrt(1. + wu*wu * m.tau*m.tau) / m.K;
+  double Tu = 2. * M_PI / wu;
+  double Kp = ZN_PI_KP * Ku;
+  double Ki = Kp * CONTROL_PERIOD / (ZN_PI_TI * Tu);
+  // Amplitude of the oscillation predicted by the describing function
+  double amplitude = 4. * RELAY_CMD / (M_PI * Ku);
+
+  printf("K=%g tau=%g L=%g\n", m.K, m.tau, m.L);
+
+  RelayAutotuner tuner;
+  size_t delay = (size_t)(m.L / SIM_STEP + 0.5);
+  std::vector<double> commands(delay + 1, 0.);
+  size_t head = 0;
+  double speed = 0., position = 0., t = 0.;
+  tuner.start(RELAY_CMD, RELAY_HYSTERESIS * amplitude, 0., t, RELAY_CYCLES);
+  while (tuner.get_state() == RelayAutotuner::running && t < SIM_DURATION) {
+    commands[head] = tuner.update(t, position);
+    head = (head + 1) % commands.size();
+    // The oldest command of the buffer is the delayed one
+    double u = commands[head];
+    speed += (m.K * u - speed) / m.tau * SIM_STEP;
+    position += speed * SIM_STEP;
+    t += SIM_STEP;
+  }
+  if (tuner.get_state() != RelayAutotuner::done) {
+    printf("  experiment did not complete (state %d) FAILED\n",
+           tuner.get_state());
+    return false;
+  }
+
+  float kp, ki;
+  tuner.compute_pi_gains(CONTROL_PERIOD, &kp, &ki);
+  bool ok = check("Ku", tuner.get_ultimate_gain(), Ku, TOLERANCE);
+  ok = check("Tu", tuner.get_ultimate_period(), Tu, TOLERANCE) && ok;
+  ok = check("Kp", kp, Kp, TOLERANCE) && ok;
+  ok = check("Ki", ki, Ki, TOLERANCE_KI) && ok;
+  return ok;
+}
+
+int main() {
+  static const Motor motors[] = {
+    {0.5, 0.10, 0.01},
+    {2.0, 0.20, 0.005},
+    {1.0, 0.05, 0.005},
+    {0.2, 0.15, 0.01},
+  };
+  int failures = 0;
+  for (size_t i=0; i < sizeof(motors) / sizeof(motors[0]); i++) {
+    if (!run_case(motors[i])) {
+      failures++;
+    }
+  }
+  if (failures > 0) {
+    printf("%d case(s) failed\n", failures);
+    return 1;
+  }
+  printf("all cases passed\n");
+  return 0;
+}
@@ -0,0 +1,68 @@
+/************************************************************************
+ * File : Arduino.h                                                     *
+ *  Minimal substitute of the Arduino core to build the hardware        *
+ *  independent parts of the KbotsLib on a host computer.               *
+ *                                                                      *
+ * This file is part of the KbotsLib for Arduino.                       *
+ * Pins and registers have no effect, micros() and millis() return the  *
+ * simulated time host_time_us, advanced by the host program.           *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __HOST_ARDUINO_H
+#define __HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+#define NOT_ON_TIMER 0
+#define TIMER1A 3
+#define TIMER2A 7
+#define TIMER2B 8
+
+#define min(a,b) ((a)<(b)?(a):(b))
+#define max(a,b) ((a)>(b)?(a):(b))
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+// Simulated time in microseconds
+extern unsigned long host_time_us;
+
+unsigned long micros();
+unsigned long millis();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+void analogWrite(uint8_t pin, int value);
+int analogRead(uint8_t pin);
+void attachInterrupt(uint8_t interrupt, void (*handler)(void), int mode);
+
+uint8_t digitalPinToPort(uint8_t pin);
+uint8_t digitalPinToBitMask(uint8_t pin);
+uint8_t digitalPinToTimer(uint8_t pin);
+volatile uint8_t *portOutputRegister(uint8_t port);
+volatile uint8_t *portInputRegister(uint8_t port);
+volatile uint8_t *portModeRegister(uint8_t port);
+volatile uint8_t *digitalPinToPCICR(uint8_t pin);
+uint8_t digitalPinToPCICRbit(uint8_t pin);
+volatile uint8_t *digitalPinToPCMSK(uint8_t pin);
+uint8_t digitalPinToPCMSKbit(uint8_t pin);
+
+#endif // __HOST_ARDUINO_H
@@ -0,0 +1,20 @@
+/************************************************************************
+ * File : avr/eeprom.h                                                  *
+ *  EEPROM accessors for host builds, backed by an array.               *
+ *                                                                      *
+ * This file is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __HOST_AVR_EEPROM_H
+#define __HOST_AVR_EEPROM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint16_t eeprom_read_word(const uint16_t *addr);
+void eeprom_update_word(uint16_t *addr, uint16_t value);
+void eeprom_read_block(void *dst, const void *addr, size_t n);
+void eeprom_update_block(const void *src, void *addr, size_t n);
+
+#endif // __HOST_AVR_EEPROM_H
@@ -0,0 +1,16 @@
+/************************************************************************
+ * File : avr/interrupt.h                                               *
+ *  Interrupt macros for host builds: vectors become plain functions.   *
+ *                                                                      *
+ * This file is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __HOST_AVR_INTERRUPT_H
+#define __HOST_AVR_INTERRUPT_H
+
+#define ISR(vector) extern "C" void vector(void)
+#define cli()
+#define sei()
+
+#endif // __HOST_AVR_INTERRUPT_H
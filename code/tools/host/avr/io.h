@@ -0,0 +1,19 @@
+/************************************************************************
+ * File : avr/io.h                                                      *
+ *  Registers of the ATmega2560 used by the KbotsLib, as plain          *
+ *  variables for host builds.                                          *
+ *                                                                      *
+ * This file is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __HOST_AVR_IO_H
+#define __HOST_AVR_IO_H
+
+#include <stdint.h>
+
+extern volatile uint8_t SREG;
+
+#define _BV(b) (1 << (b))
+
+#endif // __HOST_AVR_IO_H
@@ -0,0 +1,20 @@
+/************************************************************************
+ * File : avr/pgmspace.h                                                *
+ *  Program memory accessors for host builds: data stays in RAM.        *
+ *                                                                      *
+ * This file is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#ifndef __HOST_AVR_PGMSPACE_H
+#define __HOST_AVR_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_float(p) (*(const float *)(p))
+
+#endif // __HOST_AVR_PGMSPACE_H
@@ -0,0 +1,64 @@
+/************************************************************************
+ * File : host_arduino.cpp                                              *
+ *  Minimal substitute of the Arduino core to build the hardware        *
+ *  independent parts of the KbotsLib on a host computer.               *
+ *                                                                      *
+ * This file is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include <Arduino.h>
+#include <avr/eeprom.h>
+
+// Size of the EEPROM of the ATmega2560
+#define HOST_EEPROM_SIZE 4096
+
+unsigned long host_time_us = 0;
+volatile uint8_t SREG;
+
+static volatile uint8_t dummy_register;
+static uint8_t eeprom[HOST_EEPROM_SIZE];
+
+unsigned long micros() {
+  return host_time_us;
+}
+
+unsigned long millis() {
+  return host_time_us / 1000;
+}
+
+void pinMode(uint8_t, uint8_t) {}
+void digitalWrite(uint8_t, uint8_t) {}
+int digitalRead(uint8_t) { return LOW; }
+void analogWrite(uint8_t, int) {}
+int analogRead(uint8_t) { return 0; }
+void attachInterrupt(uint8_t, void (*)(void), int) {}
+
+uint8_t digitalPinToPort(uint8_t) { return 0; }
+uint8_t digitalPinToBitMask(uint8_t pin) { return 1 << (pin & 0x07); }
+uint8_t digitalPinToTimer(uint8_t) { return TIMER1A; }
+volatile uint8_t *portOutputRegister(uint8_t) { return &dummy_register; }
+volatile uint8_t *portInputRegister(uint8_t) { return &dummy_register; }
+volatile uint8_t *portModeRegister(uint8_t) { return &dummy_register; }
+volatile uint8_t *digitalPinToPCICR(uint8_t) { return &dummy_register; }
+uint8_t digitalPinToPCICRbit(uint8_t) { return 0; }
+volatile uint8_t *digitalPinToPCMSK(uint8_t) { return &dummy_register; }
+uint8_t digitalPinToPCMSKbit(uint8_t) { return 0; }
+
+uint16_t eeprom_read_word(const uint16_t *addr) {
+  uint16_t value;
+  eeprom_read_block(&value, addr, sizeof(value));
+  return value;
+}
+
+void eeprom_update_word(uint16_t *addr, uint16_t value) {
+  eeprom_update_block(&value, addr, sizeof(value));
+}
+
+void eeprom_read_block(void *dst, const void *addr, size_t n) {
+  memcpy(dst, eeprom + (size_t)addr, n);
+}
+
+void eeprom_update_block(const void *src, void *addr, size_t n) {
+  memcpy(eeprom + (size_t)addr, src, n);
+}
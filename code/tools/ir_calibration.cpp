@@ -0,0 +1,167 @@
+/************************************************************************
+ * File : ir_calibration.cpp                                            *
+ *  Host tool fitting the calibration table of a Sharp IR range sensor, *
+ *  to be used with IrRangeArray::add_sensor.                           *
+ *                                                                      *
+ * Compile with:                                                        *
+ *   g++ -O2 -o ir_calibration ir_calibration.cpp                       *
+ * Usage:                                                               *
+ *   ir_calibration [options] samples.txt > sharp0.h                    *
+ *  samples.txt contains one "adc distance" pair per line (raw 10 bits  *
+ *  ADC value and true distance in meters), lines starting with '#'     *
+ *  are ignored. Options:                                               *
+ *   -k points : number of points of the table (default 16)             *
+ *   -n name   : name of the generated table (default "ir_calibration") *
+ *                                                                      *
+ * The inverse of the distance of these sensors is nearly linear in the *
+ * ADC value. The table points are evenly spaced over the recorded ADC  *
+ * range and their distance is given by a local weighted linear         *
+ * regression of 1/distance, which averages the noise of the samples    *
+ * while following the real shape of the curve. The distances are then  *
+ * forced to decrease with the ADC value so that the table can be       *
+ * interpolated. The interpolation error on the samples is reported on  *
+ * the standard error.                                                  *
+ *                                                                      *
+ * This tool is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+// Minimum number of samples used by each local regression
+#define MIN_LOCAL_SAMPLES 4
+
+struct Sample {
+  double adc, d;
+};
+
+static bool by_adc(const Sample &a, const Sample &b) {
+  return a.adc < b.adc;
+}
+
+// Weighted linear regression of 1/d around an ADC value with a tricube
+// kernel of the given half width. Returns false if there are not enough
+// samples in the window.
+static bool local_fit(const std::vector<Sample> &s, double x, double h,
+                      double *inv_d) {
+  double sw = 0., sx = 0., sy = 0., sxx = 0., sxy = 0.;
+  int n = 0;
+  for (size_t i=0; i < s.size(); i++) {
+    double u = fabs(s[i].adc - x) / h;
+    if (u >= 1.) continue;
+    double w = pow(1. - u*u*u, 3.);
+    double dx = s[i].adc - x, y = 1. / s[i].d;
+    sw += w;
+    sx += w * dx;
+    sy += w * y;
+    sxx += w * dx * dx;
+    sxy += w * dx * y;
+    n++;
+  }
+  if (n < MIN_LOCAL_SAMPLES) {
+    return false;
+  }
+  double det = sw * sxx - sx * sx;
+  if (fabs(det) < 1e-12 * sw * sxx) {
+    *inv_d = sy / sw;
+  } else {
+    *inv_d = (sxx * sy - sx * sxy) / det;
+  }
+  return true;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-k points] [-n name] samples.txt\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  int n_points = 16;
+  const char *name = "ir_calibration", *file = NULL;
+
+  for (int i=1; i < argc; i++) {
+    if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0') {
+      char opt = argv[i][1];
+      if (i+1 >= argc) usage(argv[0]);
+      const char *arg = argv[++i];
+      switch (opt) {
+      case 'k': n_points = atoi(arg); break;
+      case 'n': name = arg; break;
+      default: usage(argv[0]);
+      }
+    } else {
+      file = argv[i];
+    }
+  }
+  if (file == NULL || n_points < 2 || n_points > 255) {
+    usage(argv[0]);
+  }
+
+  // Read the samples
+  FILE *f = fopen(file, "r");
+  if (f == NULL) {
+    perror(file);
+    return 1;
+  }
+  std::vector<Sample> s;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    Sample p;
+    if (line[0] != '#' && sscanf(line, "%lf %lf", &p.adc, &p.d) == 2
+        && p.d > 0.) {
+      s.push_back(p);
+    }
+  }
+  fclose(f);
+  std::sort(s.begin(), s.end(), by_adc);
+  if (s.size() < MIN_LOCAL_SAMPLES
+      || s.back().adc - s.front().adc < n_points - 1) {
+    fprintf(stderr, "%s: not enough samples\n", file);
+    return 1;
+  }
+
+  // Fit the points of the table
+  double lo = s.front().adc, hi = s.back().adc;
+  double spacing = (hi - lo) / (n_points - 1);
+  std::vector<long> adc(n_points), mm(n_points);
+  for (int k=0; k < n_points; k++) {
+    double x = lo + k * spacing, inv_d;
+    double h = 2. * spacing;
+    while (!local_fit(s, x, h, &inv_d)) {
+      h *= 1.5;
+    }
+    adc[k] = lround(x);
+    mm[k] = inv_d > 0. ? lround(1000. / inv_d) : 65535;
+    if (mm[k] > 65535) mm[k] = 65535;
+    if (k > 0 && mm[k] > mm[k-1]) mm[k] = mm[k-1];
+  }
+
+  // Interpolation error on the samples
+  double max_err = 0., sq_err = 0.;
+  for (size_t i=0; i < s.size(); i++) {
+    int k = 1;
+    while (k < n_points-1 && s[i].adc > adc[k]) k++;
+    double d = (mm[k-1] + (double)(mm[k] - mm[k-1]) * (s[i].adc - adc[k-1])
+                / (adc[k] - adc[k-1])) * 0.001;
+    double err = d - s[i].d;
+    max_err = fmax(max_err, fabs(err));
+    sq_err += err * err;
+  }
+  fprintf(stderr, "%lu samples, rms error %.4f m, max error %.4f m\n",
+          (unsigned long)s.size(), sqrt(sq_err / s.size()), max_err);
+
+  printf("// Generated by ir_calibration from %s\n", file);
+  printf("#include <KbotsLib.h>\n\n");
+  printf("#define %s_LENGTH %d\n\n", name, n_points);
+  printf("const IrCalibrationPoint %s[] PROGMEM = {\n", name);
+  for (int k=0; k < n_points; k++) {
+    printf("  {%ld, %ld},\n", adc[k], mm[k]);
+  }
+  printf("};\n");
+
+  return 0;
+}
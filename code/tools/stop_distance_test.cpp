@@ -0,0 +1,212 @@
+/************************************************************************
+ * File : stop_distance_test.cpp                                        *
+ *  Host test of SpeedProfiler::controlled_stop: measures the stopping  *
+ *  distance against the speed on both axes.                            *
+ *                                                                      *
+ * Compile with (from this directory):                                  *
+ *   g++ -O2 -Ihost -I../libraries/SimpleScheduler                      *
+ *       -I../libraries/KbotsLib -o stop_distance_test                  *
+ *       stop_distance_test.cpp host/host_arduino.cpp                   *
+ *       ../libraries/SimpleScheduler/scheduler.cpp                     *
+ *       ../libraries/KbotsLib/{speed_profiler,propulsion,odometry,     *
+ *       hbridge,pin_change,motion_profile,relay_autotuner}.cpp         *
+ * Usage:                                                               *
+ *   stop_distance_test                                                 *
+ *  Exits with a non-zero status if a stop is longer than its bound.    *
+ *                                                                      *
+ * The robot is driven at constant linear and rotational speeds, then   *
+ * controlled_stop() is called just after a run of the profiler (the    *
+ * worst case, the previous speeds are kept for a whole period). Both   *
+ * axes decelerate linearly and stop together after                     *
+ * T = max(v/a_lin, omega/a_rot), so the distance has to be at most     *
+ * v.T/2 (v^2/(2.a_lin) on a straight line) and the angle omega.T/2.    *
+ * The drive follows the speed references with a first order lag, which *
+ * adds up to v.(DRIVE_LAG + PROFILER_PERIOD) (resp. omega.(...)).      *
+ * The stop is also checked while a rotation profile is followed.       *
+ *                                                                      *
+ * This tool is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include <stdio.h>
+#include <Arduino.h>
+#include "speed_profiler.h"
+
+// Period of the profiler and simulation step in microseconds
+#define PROFILER_PERIOD 10000UL
+#define SIM_STEP 1000UL
+
+// Time constant of the drive following the speed references (s)
+#define DRIVE_LAG 0.05
+
+// Decelerations given to controlled_stop
+#define STOP_A_LIN 1.0
+#define STOP_A_ROT 5.0
+
+// Speed below which the robot is considered stopped, and time after which
+// a stop is considered as failed (microseconds)
+#define STOPPED_SPEED 1e-4
+#define STOP_TIMEOUT 10000000UL
+
+// Relative margin for the numerical errors of the simulation
+#define MARGIN 1e-3
+
+// Rotation profile interrupted by controlled_stop (rad, rad/s, rad/s^2)
+#define ROT_PROFILE_ANGLE (2.*M_PI)
+#define ROT_PROFILE_OMEGA 3.
+#define ROT_PROFILE_ALPHA 6.
+
+// Odometry whose pose is integrated by the simulation
+class SimOdometry : public Odometry {
+ public:
+  SimOdometry() : Odometry(PROFILER_PERIOD) {
+    x_ = y_ = theta_ = 0.;
+  }
+
+  void move(float ds, float dtheta) {
+    x_ += ds * cos(theta_ + dtheta / 2.);
+    y_ += ds * sin(theta_ + dtheta / 2.);
+    theta_ += dtheta;
+    if (theta_ > M_PI) {
+      theta_ -= 2.*M_PI;
+    } else if (theta_ <= -M_PI) {
+      theta_ += 2.*M_PI;
+    }
+  }
+};
+
+// Propulsion whose speed references are read by the simulation
+class SimPropulsion : public Propulsion {
+ public:
+  SimPropulsion() : Propulsion(PROFILER_PERIOD) {}
+
+  float get_linear_reference() { return lin_speed_ref_; }
+  float get_rotational_reference() { return rot_speed_ref_; }
+};
+
+static SimOdometry odometer;
+static SimPropulsion drive;
+static SpeedProfiler profiler(PROFILER_PERIOD);
+
+// Speeds of the simulated robot
+static double v_robot, omega_robot;
+
+// Advance the simulation by one step, running the profiler on its period.
+// The traveled distance and angle are accumulated.
+static void step(double *distance, double *angle) {
+  host_time_us += SIM_STEP;
+  if (host_time_us % PROFILER_PERIOD == 0) {
+    profiler.run();
+  }
+  double dt = SIM_STEP * 1e-6;
+  double alpha = dt / DRIVE_LAG;
+  v_robot += (drive.get_linear_reference() - v_robot) * alpha;
+  omega_robot += (drive.get_rotational_reference() - omega_robot) * alpha;
+  odometer.move(v_robot * dt, omega_robot * dt);
+  *distance += fabs(v_robot) * dt;
+  *angle += fabs(omega_robot) * dt;
+}
+
+// Stop the robot moving at the speeds v0 and omega0 and check the
+// distance and angle traveled
+static bool check_stop(float v0, float omega0) {
+  double distance = 0., angle = 0.;
+  double T = max(fabs(v0) / STOP_A_LIN, fabs(omega0) / STOP_A_ROT);
+  double lag = DRIVE_LAG + PROFILER_PERIOD * 1e-6;
+  double max_distance = fabs(v0) * (T / 2. + lag);
+  double max_angle = fabs(omega0) * (T / 2. + lag);
+
+  profiler.controlled_stop(STOP_A_LIN, STOP_A_ROT);
+  unsigned long start = host_time_us;
+  while (profiler.is_following_profile() != SpeedProfiler::none
+         || fabs(v_robot) > STOPPED_SPEED
+         || fabs(omega_robot) > STOPPED_SPEED) {
+    if (host_time_us - start > STOP_TIMEOUT) {
+      printf("%5.2f %6.2f   the robot did not stop FAILED\n", v0, omega0);
+      profiler.stop_motion();
+      v_robot = omega_robot = 0.;
+      return false;
+    }
+    step(&distance, &angle);
+  }
+
+  bool ok = distance <= max_distance * (1. + MARGIN) + 1e-6
+            && angle <= max_angle * (1. + MARGIN) + 1e-6;
+  printf("%5.2f %6.2f   %7.4f %7.4f   %7.4f %7.4f   %5.3f  %s\n",
+         v0, omega0, distance, max_distance, angle, max_angle,
+         (host_time_us - start) * 1e-6, ok ? "ok" : "FAILED");
+  return ok;
+}
+
+static bool run_case(float v0, float omega0) {
+  double distance = 0., angle = 0.;
+
+  // Reach steady speeds, stop just after a run of the profiler
+  drive.set_speeds(v0, omega0);
+  for (int i=0; i < 1000; i++) {
+    step(&distance, &angle);
+  }
+  step(&distance, &angle);
+
+  return check_stop(v0, omega0);
+}
+
+// Stop in the middle of a rotation profile, the given time after its start
+static bool run_rotation_case(unsigned long stop_time) {
+  double distance = 0., angle = 0.;
+
+  // Start just after a run of the profiler, stop just after another one
+  while (host_time_us % PROFILER_PERIOD != 0) {
+    step(&distance, &angle);
+  }
+  profiler.start_rotation_profile(ROT_PROFILE_ANGLE, ROT_PROFILE_OMEGA,
+                                  ROT_PROFILE_ALPHA);
+  unsigned long start = host_time_us;
+  while (host_time_us - start < stop_time + SIM_STEP) {
+    step(&distance, &angle);
+  }
+  if (profiler.is_following_profile() != SpeedProfiler::rotation) {
+    printf("rotation profile over before the stop FAILED\n");
+    return false;
+  }
+
+  printf("rotation profile stopped after %.2fs:\n", stop_time * 1e-6);
+  // The actual speeds of the robot, not the references of the profile
+  return check_stop(v_robot, omega_robot);
+}
+
+int main() {
+  static const float speeds[][2] = {
+    // Linear axis
+    {0.1, 0.}, {0.2, 0.}, {0.3, 0.}, {0.4, 0.}, {0.5, 0.}, {0.6, 0.},
+    {0.7, 0.}, {0.8, 0.}, {-0.5, 0.},
+    // Rotational axis
+    {0., 0.5}, {0., 1.}, {0., 2.}, {0., 3.}, {0., 4.}, {0., -2.},
+    // Both axes (arcs)
+    {0.5, 1.}, {0.3, 3.}, {0.8, -0.5}, {-0.4, 2.},
+  };
+
+  drive.begin(0, 0, 0, 0, 0, 0, 0., 0., &odometer, 0.2, 0.04, 0.04);
+  profiler.begin(&odometer, &drive);
+
+  printf("    v  omega   distance   bound    angle   bound     time\n");
+  int failures = 0;
+  for (size_t i=0; i < sizeof(speeds) / sizeof(speeds[0]); i++) {
+    if (!run_case(speeds[i][0], speeds[i][1])) {
+      failures++;
+    }
+  }
+  // While accelerating and while cruising
+  static const unsigned long rotation_stops[] = {200000UL, 800000UL};
+  for (size_t i=0; i < 2; i++) {
+    if (!run_rotation_case(rotation_stops[i])) {
+      failures++;
+    }
+  }
+  if (failures > 0) {
+    printf("%d case(s) failed\n", failures);
+    return 1;
+  }
+  printf("all cases passed\n");
+  return 0;
+}
@@ -0,0 +1,243 @@
+/************************************************************************
+ * File : trajectory_generator.cpp                                      *
+ *  Host tool computing time-optimal trajectories for differential      *
+ *  drive robots, to be played back by SpeedProfiler::start_trajectory. *
+ *                                                                      *
+ * Compile with:                                                        *
+ *   g++ -O2 -o trajectory_generator trajectory_generator.cpp           *
+ * Usage:                                                               *
+ *   trajectory_generator [options] path.txt > route.h                  *
+ *  path.txt contains one "x y" waypoint (meters) per line, lines       *
+ *  starting with '#' are ignored. Options:                             *
+ *   -v vmax   : maximum wheel speed in m/s (default 0.5)               *
+ *   -a amax   : maximum wheel acceleration in m/s^2 (default 1.0)      *
+ *   -w shaft  : distance between the wheels, SHAFT_WIDTH (0.1995)      *
+ *   -p period : sample period in s, the SpeedProfiler period (0.01)    *
+ *   -t theta  : initial heading in rad (default: first segment's one)  *
+ *   -d step   : path discretization step in m (default 0.005)          *
+ *   -s        : interpolate the waypoints with a Catmull-Rom spline    *
+ *               instead of following the polyline                      *
+ *   -n name   : name of the generated table (default "trajectory")     *
+ *                                                                      *
+ * The path is cut in small arcs. On each of them, the motion is        *
+ * parametrized by the travel of the fastest wheel, so that straight    *
+ * lines, curves and rotations in place (polyline corners) are handled  *
+ * the same way. A forward then backward pass gives the highest wheel   *
+ * speed allowed at each node by the wheel speed and acceleration       *
+ * limits. Wheel speed jumps caused by curvature changes are limited to *
+ * what can be done in one period.                                      *
+ *                                                                      *
+ * This tool is part of the KbotsLib for Arduino.                       *
+ *                                                                      *
+ * Copyright : (c) 2014, Xavier Lagorce <Xavier.Lagorce@crans.org>      *
+ ************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+
+// Must match the value in speed_profiler.h
+#define TRAJECTORY_FRACTION_BITS 11
+
+struct Point {
+  double x, y;
+};
+
+// Elementary arc of the path
+struct Arc {
+  double ds, dtheta;   // length and heading change
+  double u;            // travel of the fastest wheel
+  double rl, rr;       // wheels' travels divided by u
+  double t;            // duration
+};
+
+static double wrap_angle(double a) {
+  while (a > M_PI) a -= 2.*M_PI;
+  while (a <= -M_PI) a += 2.*M_PI;
+  return a;
+}
+
+static Point catmull_rom(const Point &p0, const Point &p1, const Point &p2,
+                         const Point &p3, double t) {
+  double t2 = t*t, t3 = t2*t;
+  Point p;
+  p.x = 0.5 * (2.*p1.x + (p2.x - p0.x)*t + (2.*p0.x - 5.*p1.x + 4.*p2.x - p3.x)*t2
+               + (3.*p1.x - p0.x - 3.*p2.x + p3.x)*t3);
+  p.y = 0.5 * (2.*p1.y + (p2.y - p0.y)*t + (2.*p0.y - 5.*p1.y + 4.*p2.y - p3.y)*t2
+               + (3.*p1.y - p0.y - 3.*p2.y + p3.y)*t3);
+  return p;
+}
+
+// Sample the path with points about step apart
+static std::vector<Point> discretize(const std::vector<Point> &wp, double step,
+                                     bool spline) {
+  std::vector<Point> pts;
+  pts.push_back(wp[0]);
+  for (size_t i=0; i+1 < wp.size(); i++) {
+    double chord = hypot(wp[i+1].x - wp[i].x, wp[i+1].y - wp[i].y);
+    int n = (int)ceil(chord / step);
+    for (int k=1; k <= n; k++) {
+      double t = (double)k / n;
+      if (spline) {
+        const Point &p0 = wp[i > 0 ? i-1 : i];
+        const Point &p3 = wp[i+2 < wp.size() ? i+2 : i+1];
+        pts.push_back(catmull_rom(p0, wp[i], wp[i+1], p3, t));
+      } else {
+        Point p = {wp[i].x + t*(wp[i+1].x - wp[i].x),
+                   wp[i].y + t*(wp[i+1].y - wp[i].y)};
+        pts.push_back(p);
+      }
+    }
+  }
+  return pts;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "Usage: %s [-v vmax] [-a amax] [-w shaft] [-p period] "
+          "[-t theta] [-d step] [-s] [-n name] path.txt\n", name);
+  exit(1);
+}
+
+int main(int argc, char **argv) {
+  double vmax = 0.5, amax = 1.0, shaft = 0.1995, period = 0.01, step = 0.005;
+  double theta0 = 0.;
+  bool spline = false, has_theta0 = false;
+  const char *name = "trajectory", *file = NULL;
+
+  for (int i=1; i < argc; i++) {
+    if (argv[i][0] == '-' && argv[i][1] != '\0' && argv[i][2] == '\0') {
+      char opt = argv[i][1];
+      if (opt == 's') {
+        spline = true;
+        continue;
+      }
+      if (i+1 >= argc) usage(argv[0]);
+      const char *arg = argv[++i];
+      switch (opt) {
+      case 'v': vmax = atof(arg); break;
+      case 'a': amax = atof(arg); break;
+      case 'w': shaft = atof(arg); break;
+      case 'p': period = atof(arg); break;
+      case 't': theta0 = atof(arg); has_theta0 = true; break;
+      case 'd': step = atof(arg); break;
+      case 'n': name = arg; break;
+      default: usage(argv[0]);
+      }
+    } else {
+      file = argv[i];
+    }
+  }
+  if (file == NULL || vmax <= 0. || amax <= 0. || period <= 0. || step <= 0.) {
+    usage(argv[0]);
+  }
+
+  // Read the waypoints
+  FILE *f = fopen(file, "r");
+  if (f == NULL) {
+    perror(file);
+    return 1;
+  }
+  std::vector<Point> wp;
+  char line[256];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    Point p;
+    if (line[0] != '#' && sscanf(line, "%lf %lf", &p.x, &p.y) == 2) {
+      wp.push_back(p);
+    }
+  }
+  fclose(f);
+  if (wp.size() < 2) {
+    fprintf(stderr, "%s: at least two waypoints are needed\n", file);
+    return 1;
+  }
+
+  // Cut the path into arcs. The heading change at a node is done on the
+  // arc following it.
+  std::vector<Point> pts = discretize(wp, step, spline);
+  std::vector<Arc> arcs;
+  double heading = has_theta0 ? theta0 : atan2(pts[1].y - pts[0].y, pts[1].x - pts[0].x);
+  for (size_t i=0; i+1 < pts.size(); i++) {
+    Arc a;
+    a.ds = hypot(pts[i+1].x - pts[i].x, pts[i+1].y - pts[i].y);
+    if (a.ds <= 0.) continue;
+    double h = atan2(pts[i+1].y - pts[i].y, pts[i+1].x - pts[i].x);
+    a.dtheta = wrap_angle(h - heading);
+    heading = h;
+    double dl = a.ds - a.dtheta * shaft / 2., dr = a.ds + a.dtheta * shaft / 2.;
+    a.u = fmax(fabs(dl), fabs(dr));
+    a.rl = dl / a.u;
+    a.rr = dr / a.u;
+    // Cut long rotations (polyline corners) so that the speed can change
+    // along them
+    int pieces = (int)ceil(a.u / step);
+    a.ds /= pieces;
+    a.dtheta /= pieces;
+    a.u /= pieces;
+    for (int k=0; k < pieces; k++) {
+      arcs.push_back(a);
+    }
+  }
+
+  // Highest wheel speed at each node: speed limit and junction limits
+  size_t n = arcs.size();
+  std::vector<double> w(n+1, vmax);
+  w[0] = 0.;
+  w[n] = 0.;
+  for (size_t j=1; j < n; j++) {
+    double jump = fmax(fabs(arcs[j].rl - arcs[j-1].rl), fabs(arcs[j].rr - arcs[j-1].rr));
+    if (jump > 0.) {
+      w[j] = fmin(w[j], amax * period / jump);
+    }
+  }
+
+  // Forward (acceleration) and backward (deceleration) passes
+  for (size_t j=0; j < n; j++) {
+    w[j+1] = fmin(w[j+1], sqrt(w[j]*w[j] + 2.*amax*arcs[j].u));
+  }
+  for (size_t j=n; j > 0; j--) {
+    w[j-1] = fmin(w[j-1], sqrt(w[j]*w[j] + 2.*amax*arcs[j-1].u));
+  }
+
+  // Duration of each arc (constant acceleration of the fastest wheel)
+  double total = 0.;
+  for (size_t j=0; j < n; j++) {
+    arcs[j].t = w[j] + w[j+1] > 0. ? 2. * arcs[j].u / (w[j] + w[j+1]) : 0.;
+    total += arcs[j].t;
+  }
+
+  // Sample the speeds at the middle of each period
+  long n_samples = (long)ceil(total / period) + 1;
+  double scale = (double)(1 << TRAJECTORY_FRACTION_BITS);
+  printf("// Generated by trajectory_generator from %s\n", file);
+  printf("//  vmax=%g m/s, amax=%g m/s^2, shaft=%g m, duration=%.3f s\n",
+         vmax, amax, shaft, total);
+  printf("#include <KbotsLib.h>\n\n");
+  printf("#define %s_LENGTH %ld\n", name, n_samples);
+  printf("#define %s_PERIOD %ldUL\n\n", name, (long)lround(period * 1e6));
+  printf("const TrajectorySample %s[] PROGMEM = {\n", name);
+  size_t j = 0;
+  double t_start = 0.;
+  for (long k=0; k < n_samples; k++) {
+    double t = (k + 0.5) * period;
+    while (j < n && t >= t_start + arcs[j].t) {
+      t_start += arcs[j].t;
+      j++;
+    }
+    double v = 0., omega = 0.;
+    if (j < n && arcs[j].t > 0.) {
+      double ws = w[j] + (w[j+1] - w[j]) * (t - t_start) / arcs[j].t;
+      v = ws * arcs[j].ds / arcs[j].u;
+      omega = ws * arcs[j].dtheta / arcs[j].u;
+    }
+    long fv = lround(v * scale), fw = lround(omega * scale);
+    if (fv > 32767 || fv < -32768 || fw > 32767 || fw < -32768) {
+      fprintf(stderr, "speed out of the fixed point range at t=%g\n", t);
+      return 1;
+    }
+    printf("  {%ld, %ld},\n", fv, fw);
+  }
+  printf("};\n");
+
+  return 0;
+}